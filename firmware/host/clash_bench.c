@@ -0,0 +1,225 @@
+/**
+ * @file clash_bench.c
+ * @brief Clash detector benchmark
+ *
+ * Runs the clash detector of clash.c over a recorded motion trace, in the
+ * same CSV format as the simulator, decimated to IMU_FIFO_ODR_HZ and scaled
+ * to IMU_FIFO_ACCEL_FS_SEL as the IMU FIFO would deliver it. Reports
+ *  - the time per sample, in TSC cycles on x86 and in ns, over repeated runs
+ *    of the whole trace,
+ *  - every clash detected, and with the true clash times given by -c, the
+ *    detection latency of each, the misses and the false positives.
+ *
+ * Latencies are those of the detector alone. On the saber, samples reach it
+ * after up to IMU_FIFO_BURST sample periods in the FIFO, plus the burst read.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define BENCH_HAVE_TSC
+#endif
+
+#include "config.h"
+#include "imu.h"
+#include "clash.h"
+
+
+#define BENCH_MAX_TRUTH         256
+#define BENCH_DEFAULT_REPEAT    200
+// A detection this long after a true clash is counted for it
+#define BENCH_DEFAULT_WINDOW_MS 100
+
+
+typedef struct {
+    uint32_t t_ms;
+    imu_sample_t s;
+} bench_row_t;
+
+
+static bench_row_t* rows;
+static size_t n_rows;
+
+
+static int16_t __scale(int v, uint8_t fs_sel) {
+    v /= (1 << fs_sel);
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    if (v < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) v;
+}
+
+
+// Keep one row per IMU_FIFO_ODR_HZ sample
+static bool __load_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    uint32_t period_ms = 1000 / IMU_FIFO_ODR_HZ;
+    size_t cap = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (!isdigit((unsigned char) line[0]))
+            continue;
+
+        int v[7];
+        if (sscanf(line, "%d,%d,%d,%d,%d,%d,%d",
+                   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) < 7) {
+            fprintf(stderr, "%s: bad row: %s", path, line);
+            fclose(f);
+            return false;
+        }
+        if (v[0] % period_ms)
+            continue;
+
+        bench_row_t r;
+        r.t_ms = (uint32_t) v[0];
+        for (uint8_t k = 0; k < 3; k++) {
+            r.s.accel[k] = __scale(v[1 + k], IMU_FIFO_ACCEL_FS_SEL);
+            r.s.gyro[k] = __scale(v[4 + k], IMU_FIFO_GYRO_FS_SEL);
+        }
+
+        if (n_rows == cap) {
+            cap = cap ? 2 * cap : 1024;
+            rows = realloc(rows, cap * sizeof(bench_row_t));
+        }
+        rows[n_rows++] = r;
+    }
+
+    fclose(f);
+    if (n_rows == 0) {
+        fprintf(stderr, "%s: no samples\n", path);
+        return false;
+    }
+    return true;
+}
+
+
+static uint64_t __now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void __bench_speed(uint32_t repeat) {
+    volatile uint32_t sink = 0;
+
+    uint64_t t0 = __now_ns();
+    #ifdef BENCH_HAVE_TSC
+        uint64_t c0 = __rdtsc();
+    #endif
+
+    for (uint32_t r = 0; r < repeat; r++) {
+        clash_reset();
+        for (size_t i = 0; i < n_rows; i++) {
+            sink += clash_update(&rows[i].s, 1);
+        }
+    }
+
+    #ifdef BENCH_HAVE_TSC
+        uint64_t cycles = __rdtsc() - c0;
+    #endif
+    uint64_t ns = __now_ns() - t0;
+    double n = (double) repeat * n_rows;
+    (void) sink;
+
+    printf("%zu samples at %d Hz, %u runs\n", n_rows, IMU_FIFO_ODR_HZ, repeat);
+    #ifdef BENCH_HAVE_TSC
+        printf("  %.1f TSC cycles/sample\n", cycles / n);
+    #endif
+    printf("  %.1f ns/sample\n", ns / n);
+}
+
+
+static void __bench_detect(const uint32_t* truth, size_t n_truth,
+                           uint32_t window_ms) {
+    bool found[BENCH_MAX_TRUTH] = {false};
+    uint32_t n_false = 0;
+
+    clash_reset();
+    for (size_t i = 0; i < n_rows; i++) {
+        uint32_t jerk = clash_update(&rows[i].s, 1);
+        if (jerk == 0)
+            continue;
+
+        uint32_t t = rows[i].t_ms;
+        float gps = (float) jerk * IMU_FIFO_ODR_HZ / (16384 >> IMU_FIFO_ACCEL_FS_SEL);
+
+        // Match the latest true clash before it
+        int match = -1;
+        for (size_t k = 0; k < n_truth; k++) {
+            if ((truth[k] <= t) && (t - truth[k] <= window_ms))
+                match = (int) k;
+        }
+
+        if (n_truth == 0) {
+            printf("  clash at %u ms, %.0f g/s\n", t, gps);
+        } else if ((match >= 0) && !found[match]) {
+            found[match] = true;
+            printf("  clash at %u ms, %.0f g/s, latency %u ms\n",
+                   truth[match], gps, t - truth[match]);
+        } else {
+            n_false++;
+            printf("  false positive at %u ms, %.0f g/s\n", t, gps);
+        }
+    }
+
+    for (size_t k = 0; k < n_truth; k++) {
+        if (!found[k])
+            printf("  missed clash at %u ms\n", truth[k]);
+    }
+    if (n_truth > 0)
+        printf("%u false positives\n", n_false);
+}
+
+
+static void __usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-c t_ms]... [-w window_ms] [-r runs] trace.csv\n", prog);
+}
+
+
+int main(int argc, char** argv) {
+    uint32_t truth[BENCH_MAX_TRUTH];
+    size_t n_truth = 0;
+    uint32_t window_ms = BENCH_DEFAULT_WINDOW_MS;
+    uint32_t repeat = BENCH_DEFAULT_REPEAT;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:w:r:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                if (n_truth < BENCH_MAX_TRUTH)
+                    truth[n_truth++] = strtoul(optarg, NULL, 0);
+                break;
+            case 'w': window_ms = strtoul(optarg, NULL, 0); break;
+            case 'r': repeat = strtoul(optarg, NULL, 0); break;
+            default:
+                __usage(argv[0]);
+                return (opt == 'h') ? 0 : 2;
+        }
+    }
+    if ((optind != argc - 1) || (repeat == 0)) {
+        __usage(argv[0]);
+        return 2;
+    }
+
+    if (!__load_trace(argv[optind]))
+        return 1;
+
+    __bench_speed(repeat);
+    __bench_detect(truth, n_truth, window_ms);
+    return 0;
+}
@@ -0,0 +1,869 @@
+/**
+ * @file hal_host.c
+ * @brief Hardware abstraction layer, host implementation
+ */
+
+
+#include <string.h>
+
+#include "config.h"
+#include "pinmap.h"
+#include "tick.h"
+#include "imu.h"
+#include "hal.h"
+#include "hal_host.h"
+
+
+#define PIN_SYS_WAKEUP          PIN_BTN
+
+#define HOST_N_GPIOS            30
+
+// PWM wraps per second, one DMA transfer each
+#define HOST_AUDIO_WRAP_RATE    ((uint64_t) SPK_SAMPLE_RATE * SPK_N_REPETITIONS)
+
+#define MPU6050_WHOAMI              0x68
+
+// Motion thresholds are 2 mg/LSB, acceleration 16384 LSB/g at +-2 g
+#define MPU6050_THR_LSB             (2 * 16384.0f / 1000)
+// 5 Hz high-pass at the 1 kHz accelerometer rate: RC / (RC + dt)
+#define MPU6050_HPF_5HZ             0.9695f
+
+
+// ------------------------------ TIME -----------------------------------------
+static uint64_t now_us;
+static host_step_hook_t step_hook;
+static bool exit_requested;
+static bool dormant;
+static bool irq_enabled;
+static bool in_irq;
+static uint32_t rand_state;
+
+static bool tick_enabled;
+static uint64_t next_tick_us;
+
+// LED render tick
+static hal_led_timer_callback_t led_timer_callback;
+static uint32_t led_timer_period_us;
+static uint64_t led_timer_next_us;
+
+static void __service();
+
+
+void host_set_step_hook(host_step_hook_t hook) {
+    step_hook = hook;
+}
+
+uint64_t host_time_us() {
+    return now_us;
+}
+
+void host_advance_us(uint64_t us) {
+    uint64_t target = now_us + us;
+
+    while (now_us < target) {
+        uint64_t step = target - now_us;
+        if (step > HOST_STEP_US)
+            step = HOST_STEP_US;
+        now_us += step;
+
+        if (step_hook)
+            step_hook(now_us);
+        __service();
+    }
+}
+
+void host_request_exit() {
+    exit_requested = true;
+}
+
+bool host_exit_requested() {
+    return exit_requested;
+}
+
+void host_seed(uint32_t seed) {
+    // xorshift32 gets stuck at 0
+    rand_state = seed ? seed : 1;
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ SYSTEM ---------------------------------------
+static bool gpio_level[HOST_N_GPIOS];
+static bool wakeup_edge;
+
+
+void hal_sys_init() {
+}
+
+
+void hal_go_dormant() {
+    // Clocks are stopped: no tick, no audio, only the wakeup edge
+    dormant = true;
+    wakeup_edge = false;
+    while (!wakeup_edge && !exit_requested) {
+        host_advance_us(HOST_STEP_US);
+    }
+    dormant = false;
+
+    // The ticks start over with the clocks
+    next_tick_us = now_us + 1000;
+    led_timer_next_us = now_us + led_timer_period_us;
+}
+
+
+uint32_t hal_irq_disable() {
+    uint32_t status = irq_enabled;
+    irq_enabled = false;
+    return status;
+}
+
+void hal_irq_restore(uint32_t status) {
+    irq_enabled = status;
+    // Deliver whatever came in while masked
+    if (irq_enabled)
+        __service();
+}
+
+
+void hal_sleep_ms(uint32_t ms) {
+    host_advance_us((uint64_t) ms * 1000);
+}
+
+void hal_idle() {
+    host_advance_us(HOST_STEP_US);
+}
+
+// Interrupts that come due while masked are delivered once unmasked
+void hal_wait_for_interrupt() {
+    host_advance_us(HOST_STEP_US);
+}
+
+
+uint32_t hal_rand_bit() {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state & 0x0001;
+}
+
+
+uint32_t hal_time_us() {
+    return (uint32_t) now_us;
+}
+
+void hal_console_init() {
+    // printf() already goes to stdout
+}
+
+
+void hal_tick_init(uint32_t clk_khz) {
+    (void) clk_khz;
+    tick_enabled = true;
+    next_tick_us = now_us + 1000;
+}
+
+
+// Virtual time does not depend on the clock
+uint32_t hal_sys_set_clock(uint8_t level) {
+    static const uint32_t khz[] = SYS_CLK_LEVEL_KHZ;
+    return khz[level];
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ MULTICORE ------------------------------------
+// Core 1 runs whenever it is sent a word: the handler is called right away,
+// as if core 1 had been waiting for it. Words the other way are delivered to
+// core 0 like an interrupt. Only one core runs at a time, so there is
+// nothing to lock.
+#define HOST_CORE0_FIFO_LEN     64      // Drained between steps only
+
+static uint8_t current_core;
+static hal_core_msg_handler_t core_handlers[2];
+static uint32_t core0_fifo[HOST_CORE0_FIFO_LEN];
+static uint32_t core0_fifo_n;
+
+
+void hal_core1_launch(void (*init)(), hal_core_msg_handler_t core1_handler,
+                      hal_core_msg_handler_t core0_handler) {
+    core_handlers[1] = core1_handler;
+    core_handlers[0] = core0_handler;
+
+    current_core = 1;
+    init();
+    current_core = 0;
+}
+
+
+bool hal_core_send(uint32_t msg) {
+    if (current_core == 1) {
+        if (core0_fifo_n == HOST_CORE0_FIFO_LEN)
+            return false;
+        core0_fifo[core0_fifo_n++] = msg;
+        return true;
+    }
+
+    current_core = 1;
+    core_handlers[1](msg);
+    current_core = 0;
+    return true;
+}
+
+uint8_t hal_core_num() {
+    return current_core;
+}
+
+
+uint32_t hal_lock_cores() {
+    return hal_irq_disable();
+}
+
+void hal_unlock_cores(uint32_t status) {
+    hal_irq_restore(status);
+}
+
+
+static void __cores_service() {
+    for (uint32_t i = 0; i < core0_fifo_n; i++) {
+        core_handlers[0](core0_fifo[i]);
+    }
+    core0_fifo_n = 0;
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ GPIO -----------------------------------------
+static hal_gpio_irq_callback_t gpio_callbacks[HOST_N_GPIOS];
+static bool gpio_pending[HOST_N_GPIOS];
+
+
+void hal_gpio_init(uint8_t pin, bool out) {
+    (void) out;
+    gpio_callbacks[pin] = NULL;
+    gpio_pending[pin] = false;
+}
+
+void hal_gpio_put(uint8_t pin, bool value) {
+    gpio_level[pin] = value;
+}
+
+bool hal_gpio_get(uint8_t pin) {
+    return gpio_level[pin];
+}
+
+
+void hal_gpio_irq_falling(uint8_t pin, hal_gpio_irq_callback_t callback) {
+    gpio_callbacks[pin] = callback;
+}
+
+
+void host_gpio_set(uint8_t pin, bool value) {
+    bool prev = gpio_level[pin];
+    gpio_level[pin] = value;
+
+    if (prev && !value && gpio_callbacks[pin])
+        gpio_pending[pin] = true;
+    if (!prev && value && (pin == PIN_SYS_WAKEUP))
+        wakeup_edge = true;
+}
+
+bool host_gpio_level(uint8_t pin) {
+    return gpio_level[pin];
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ I2C ------------------------------------------
+// Fake MPU-6050: a register file with an auto-incrementing register pointer,
+// and the FIFO
+static uint8_t imu_regs[128];
+static uint8_t imu_ptr;
+static uint8_t imu_fifo[MPU6050_FIFO_SIZE];
+static uint32_t imu_fifo_head;
+static uint32_t imu_fifo_count;
+static uint32_t imu_sample_div;
+
+static void __imu_motion_reset();
+
+
+static void __imu_fifo_reset() {
+    imu_fifo_head = 0;
+    imu_fifo_count = 0;
+}
+
+
+static void __imu_power_on_reset() {
+    memset(imu_regs, 0, sizeof(imu_regs));
+    imu_regs[MPU6050_REG_PWR_MGMT_1] = 0x40;
+    imu_regs[MPU6050_REG_WHOAMI] = MPU6050_WHOAMI;
+    imu_ptr = 0;
+    imu_sample_div = 0;
+    __imu_fifo_reset();
+    __imu_motion_reset();
+}
+
+
+// Side effects of reading a register
+static uint8_t __imu_read_reg(uint8_t reg) {
+    uint8_t value = imu_regs[reg];
+
+    if (reg == MPU6050_REG_INT_STATUS) {
+        imu_regs[reg] = 0;
+        host_gpio_set(PIN_IMU_INT, 1);
+    } else if (reg == MPU6050_REG_FIFO_COUNTH) {
+        value = imu_fifo_count >> 8;
+    } else if (reg == MPU6050_REG_FIFO_COUNTH + 1) {
+        value = imu_fifo_count & 0xff;
+    } else if ((reg == MPU6050_REG_FIFO_R_W) && (imu_fifo_count > 0)) {
+        value = imu_fifo[imu_fifo_head];
+        imu_fifo_head = (imu_fifo_head + 1) % MPU6050_FIFO_SIZE;
+        imu_fifo_count--;
+    }
+    return value;
+}
+
+
+// Side effects of writing a register
+static void __imu_write_reg(uint8_t reg, uint8_t value) {
+    if ((reg == MPU6050_REG_PWR_MGMT_1) && (value & 0x80)) {
+        // Device reset, which completes immediately
+        __imu_power_on_reset();
+        return;
+    }
+    if (reg == MPU6050_REG_USER_CTRL) {
+        // FIFO_RESET clears itself
+        if (value & 0x04)
+            __imu_fifo_reset();
+        value &= ~0x04;
+    }
+    imu_regs[reg] = value;
+}
+
+
+// Burst reads of FIFO_R_W keep popping the FIFO
+static uint8_t __imu_next_ptr(uint8_t ptr) {
+    if (ptr == MPU6050_REG_FIFO_R_W)
+        return ptr;
+    return (ptr + 1) & 0x7f;
+}
+
+
+// A transfer on the bus, carried out in one go once its bytes have been
+// clocked out
+static bool i2c_busy;
+static uint32_t i2c_baud;
+static uint8_t i2c_addr;
+static const uint8_t* i2c_src;
+static size_t i2c_src_len;
+static uint8_t* i2c_dst;
+static size_t i2c_dst_len;
+static hal_i2c_callback_t i2c_callback;
+static uint64_t i2c_done_us;
+
+
+static bool __i2c_do(uint8_t addr, const uint8_t* src, size_t src_len,
+                     uint8_t* dst, size_t dst_len) {
+    if (addr != IMU_I2C_ADDR)
+        return false;
+
+    if (src_len > 0) {
+        imu_ptr = src[0] & 0x7f;
+        for (size_t i = 1; i < src_len; i++) {
+            __imu_write_reg(imu_ptr, src[i]);
+            imu_ptr = __imu_next_ptr(imu_ptr);
+        }
+    }
+    for (size_t i = 0; i < dst_len; i++) {
+        dst[i] = __imu_read_reg(imu_ptr);
+        imu_ptr = __imu_next_ptr(imu_ptr);
+    }
+    return true;
+}
+
+
+// Wait out a transfer in flight
+static void __i2c_wait() {
+    while (i2c_busy) {
+        hal_idle();
+    }
+}
+
+
+void hal_i2c_init(uint32_t baud) {
+    i2c_baud = baud;
+    i2c_busy = false;
+}
+
+int hal_i2c_write(uint8_t addr, const uint8_t* src, size_t len) {
+    __i2c_wait();
+    return __i2c_do(addr, src, len, NULL, 0) ? (int) len : -1;
+}
+
+int hal_i2c_write_read(uint8_t addr, const uint8_t* src, size_t src_len,
+                       uint8_t* dst, size_t dst_len) {
+    __i2c_wait();
+    return __i2c_do(addr, src, src_len, dst, dst_len) ? (int) dst_len : -1;
+}
+
+
+bool hal_i2c_transfer_async(uint8_t addr, const uint8_t* src, size_t src_len,
+                            uint8_t* dst, size_t dst_len,
+                            hal_i2c_callback_t callback) {
+    if (i2c_busy || (src_len + dst_len == 0))
+        return false;
+
+    i2c_busy = true;
+    i2c_addr = addr;
+    i2c_src = src;
+    i2c_src_len = src_len;
+    i2c_dst = dst;
+    i2c_dst_len = dst_len;
+    i2c_callback = callback;
+
+    // 9 clocks per byte, plus the address bytes
+    uint32_t n_bytes = 1 + src_len + dst_len + ((src_len && dst_len) ? 1 : 0);
+    uint32_t baud = i2c_baud ? i2c_baud : 100000;
+    i2c_done_us = now_us + ((uint64_t) n_bytes * 9 * 1000000 + baud - 1) / baud;
+    return true;
+}
+
+
+static void __i2c_service() {
+    if (!i2c_busy || (now_us < i2c_done_us))
+        return;
+
+    bool ok = __i2c_do(i2c_addr, i2c_src, i2c_src_len, i2c_dst, i2c_dst_len);
+    i2c_busy = false;
+    i2c_callback(ok);
+}
+
+
+// Motion detection engine, as the register map describes it: every
+// accelerometer sample goes through the digital high-pass filter, then
+//  - motion: any axis above MOT_THR for MOT_DUR ms. Raised once, then not
+//    again until the count has decayed back to 0.
+//  - zero-motion: every axis below ZRMOT_THR for ZRMOT_DUR * 64 ms, and any
+//    axis above it again afterwards. MOT_ZRMOT tells the two apart.
+static float hpf_prev_in[3];
+static float hpf_out[3];
+static uint32_t mot_count;
+static bool mot_raised;
+static uint32_t zrmot_count;
+static bool zero_motion;
+
+
+static void __imu_motion_reset() {
+    for (uint8_t i = 0; i < 3; i++) {
+        hpf_prev_in[i] = 0;
+        hpf_out[i] = 0;
+    }
+    mot_count = 0;
+    mot_raised = false;
+    zrmot_count = 0;
+    zero_motion = false;
+}
+
+
+// Run the motion detection engine on one sample, return the interrupt
+// sources raised
+static uint8_t __imu_motion(const int32_t accel[3]) {
+    bool hpf_5hz = ((imu_regs[MPU6050_REG_ACCEL_CONFIG] & 0x07) == 0x01);
+    float mot_thr = imu_regs[MPU6050_REG_MOT_THR] * MPU6050_THR_LSB;
+    float zrmot_thr = imu_regs[MPU6050_REG_ZRMOT_THR] * MPU6050_THR_LSB;
+    uint32_t mot_dur = imu_regs[MPU6050_REG_MOT_DUR];
+    uint32_t zrmot_dur = imu_regs[MPU6050_REG_ZRMOT_DUR] * 64;
+    bool over_mot = false;
+    bool over_zrmot = false;
+
+    for (uint8_t i = 0; i < 3; i++) {
+        float a = accel[i];
+        float out = hpf_5hz ? MPU6050_HPF_5HZ * (hpf_out[i] + a - hpf_prev_in[i]) : a;
+        hpf_prev_in[i] = a;
+        hpf_out[i] = out;
+
+        float mag = (out < 0) ? -out : out;
+        over_mot |= (mag > mot_thr);
+        over_zrmot |= (mag > zrmot_thr);
+    }
+
+    uint8_t raised = 0;
+
+    if (over_mot) {
+        if (mot_count < mot_dur)
+            mot_count++;
+        if ((mot_count >= mot_dur) && !mot_raised) {
+            mot_raised = true;
+            raised |= MPU6050_INT_MOT;
+        }
+    } else if (mot_count > 0) {
+        mot_count--;
+    } else {
+        mot_raised = false;
+    }
+
+    if (over_zrmot) {
+        zrmot_count = 0;
+        if (zero_motion) {
+            zero_motion = false;
+            imu_regs[MPU6050_REG_MOT_DETECT_STATUS] = 0x00;
+            raised |= MPU6050_INT_ZMOT;
+        }
+    } else if (!zero_motion) {
+        zrmot_count++;
+        if (zrmot_count >= zrmot_dur) {
+            zero_motion = true;
+            imu_regs[MPU6050_REG_MOT_DETECT_STATUS] = 0x01;
+            raised |= MPU6050_INT_ZMOT;
+        }
+    }
+
+    return raised;
+}
+
+
+// Raise interrupt sources, as far as they are enabled. The INT pin either
+// stays low until INT_STATUS is read (LATCH_INT_EN), or pulses.
+static uint8_t __imu_raise(uint8_t bits) {
+    bits &= imu_regs[MPU6050_REG_INT_ENABLE];
+    if (bits == 0)
+        return 0;
+
+    imu_regs[MPU6050_REG_INT_STATUS] |= bits;
+    host_gpio_set(PIN_IMU_INT, 0);
+    if (!(imu_regs[MPU6050_REG_INT_PIN_CFG] & 0x20))
+        host_gpio_set(PIN_IMU_INT, 1);
+    return bits;
+}
+
+
+// Scale a +-2 g / +-250 dps reading to a full scale range, saturating as the
+// data registers do
+static int16_t __imu_scale(int32_t v, uint8_t fs_sel) {
+    v /= (1 << fs_sel);
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    if (v < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) v;
+}
+
+
+// Write one sample to the FIFO, as much of it as FIFO_EN selects. A full FIFO
+// drops new data and raises FIFO_OFLOW.
+static uint8_t __imu_fifo_push(const int16_t accel[3], const int16_t gyro[3]) {
+    uint8_t fifo_en = imu_regs[MPU6050_REG_FIFO_EN];
+    if (!(imu_regs[MPU6050_REG_USER_CTRL] & 0x40) || !(fifo_en & 0x78))
+        return 0;
+
+    uint8_t bytes[MPU6050_FIFO_SAMPLE_BYTES];
+    uint32_t n = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (fifo_en & 0x08) {
+            bytes[n++] = (uint16_t) accel[i] >> 8;
+            bytes[n++] = accel[i] & 0xff;
+        }
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        if (fifo_en & (0x40 >> i)) {
+            bytes[n++] = (uint16_t) gyro[i] >> 8;
+            bytes[n++] = gyro[i] & 0xff;
+        }
+    }
+
+    if (imu_fifo_count + n > MPU6050_FIFO_SIZE)
+        return MPU6050_INT_FIFO_OFLOW;
+
+    for (uint32_t i = 0; i < n; i++) {
+        imu_fifo[(imu_fifo_head + imu_fifo_count) % MPU6050_FIFO_SIZE] = bytes[i];
+        imu_fifo_count++;
+    }
+    return 0;
+}
+
+
+uint8_t host_imu_set_sample(const int32_t accel[3], const int32_t gyro[3]) {
+    uint8_t accel_fs = (imu_regs[MPU6050_REG_ACCEL_CONFIG] >> 3) & 0x03;
+    uint8_t gyro_fs = (imu_regs[MPU6050_REG_GYRO_CONFIG] >> 3) & 0x03;
+    int16_t a[3];
+    int16_t g[3];
+
+    for (uint8_t i = 0; i < 3; i++) {
+        a[i] = __imu_scale(accel[i], accel_fs);
+        g[i] = __imu_scale(gyro[i], gyro_fs);
+        imu_regs[MPU6050_REG_ACCEL_XOUT_H + 2 * i] = (uint16_t) a[i] >> 8;
+        imu_regs[MPU6050_REG_ACCEL_XOUT_H + 2 * i + 1] = a[i] & 0xff;
+        imu_regs[MPU6050_REG_GYRO_XOUT_H + 2 * i] = (uint16_t) g[i] >> 8;
+        imu_regs[MPU6050_REG_GYRO_XOUT_H + 2 * i + 1] = g[i] & 0xff;
+    }
+
+    // Asleep, or not set up yet
+    if (imu_regs[MPU6050_REG_PWR_MGMT_1] & 0x40)
+        return 0;
+
+    // The motion thresholds do not depend on the full scale range
+    uint8_t raised = __imu_motion(accel);
+
+    // Samples come out at 1 kHz / (1 + SMPLRT_DIV)
+    if (imu_sample_div == 0) {
+        raised |= __imu_fifo_push(a, g) | MPU6050_INT_DATA_RDY;
+        imu_sample_div = imu_regs[MPU6050_REG_SMPLRT_DIV];
+    } else {
+        imu_sample_div--;
+    }
+
+    return __imu_raise(raised);
+}
+
+void host_imu_interrupt(uint8_t int_status, uint8_t mot_detect_status) {
+    if (int_status & imu_regs[MPU6050_REG_INT_ENABLE])
+        imu_regs[MPU6050_REG_MOT_DETECT_STATUS] = mot_detect_status;
+    __imu_raise(int_status);
+}
+
+uint8_t host_imu_reg(uint8_t reg) {
+    return imu_regs[reg & 0x7f];
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ AUDIO ----------------------------------------
+// The two halves are played back to back at the PWM wrap rate. Audio time is
+// counted in wraps since the start, so block boundaries don't drift.
+static uint16_t* audio_buf[2];
+static uint32_t audio_len;
+static hal_audio_callback_t audio_callback;
+static host_audio_sink_t audio_sink;
+static bool audio_running;
+static uint8_t audio_half;
+static uint64_t audio_start_us;
+static uint64_t audio_wraps;
+static uint8_t audio_core;              // Where the audio interrupt runs
+
+
+void hal_audio_init(uint16_t* buf0, uint16_t* buf1, uint32_t len,
+                    hal_audio_callback_t callback) {
+    audio_buf[0] = buf0;
+    audio_buf[1] = buf1;
+    audio_len = len;
+    audio_callback = callback;
+    audio_running = false;
+    audio_core = current_core;
+}
+
+void hal_audio_start() {
+    if (audio_running)
+        return;
+    audio_running = true;
+    audio_half = 0;
+    audio_start_us = now_us;
+    audio_wraps = 0;
+}
+
+void hal_audio_stop() {
+    audio_running = false;
+}
+
+
+void host_set_audio_sink(host_audio_sink_t sink) {
+    audio_sink = sink;
+}
+
+
+// Finish every half-buffer due by now
+static void __audio_service() {
+    while (audio_running) {
+        uint64_t elapsed = (now_us - audio_start_us) * HOST_AUDIO_WRAP_RATE / 1000000;
+        if (elapsed < audio_wraps + audio_len)
+            return;
+
+        uint8_t half = audio_half;
+        if (audio_sink) {
+            uint64_t t_us = audio_start_us + audio_wraps * 1000000 / HOST_AUDIO_WRAP_RATE;
+            audio_sink(t_us, audio_buf[half], audio_len);
+        }
+        audio_wraps += audio_len;
+        audio_half ^= 1;
+
+        uint8_t core = current_core;
+        current_core = audio_core;
+        audio_callback(half);
+        current_core = core;
+    }
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ LED STRIP ------------------------------------
+// A frame takes 24 bits per LED, then the reset time, as on the saber,
+// whatever the number of strands. The sink sees it when sending starts, as
+// GRB pixels, strand after strand.
+#if LEDSTRIP_N_STRANDS > 1
+    #define HOST_LED_BITS_PER_WORD  4
+#else
+    #define HOST_LED_BITS_PER_WORD  24
+#endif
+#define HOST_LED_US_PER_WORD    ((HOST_LED_BITS_PER_WORD * 1000000) / LEDSTRIP_BIT_RATE_HZ)
+#define HOST_LED_MAX_WORDS      ((N_LEDSTRIP_LEDS * 24) / HOST_LED_BITS_PER_WORD)
+
+static host_led_sink_t led_sink;
+static hal_led_callback_t led_done;
+static bool led_busy;
+static uint64_t led_done_us;
+static uint32_t led_grb[LEDSTRIP_N_STRANDS * N_LEDSTRIP_LEDS];
+
+
+void hal_led_init(hal_led_callback_t done) {
+    led_done = done;
+    led_busy = false;
+}
+
+
+// Back from the words the PIO takes to pixels
+static uint32_t __led_pixels(const uint32_t* frame, uint32_t n) {
+    if (n > HOST_LED_MAX_WORDS)
+        n = HOST_LED_MAX_WORDS;
+
+    #if LEDSTRIP_N_STRANDS > 1
+        const uint8_t* planes = (const uint8_t*) frame;
+        uint32_t n_leds = (n * HOST_LED_BITS_PER_WORD) / 24;
+        for (uint8_t s = 0; s < LEDSTRIP_N_STRANDS; s++) {
+            for (uint32_t i = 0; i < n_leds; i++) {
+                uint32_t grb = 0;
+                for (uint8_t b = 0; b < 24; b++) {
+                    grb = (grb << 1) | ((planes[24 * i + b] >> s) & 1);
+                }
+                led_grb[s * n_leds + i] = grb;
+            }
+        }
+        return LEDSTRIP_N_STRANDS * n_leds;
+    #else
+        for (uint32_t i = 0; i < n; i++) {
+            led_grb[i] = frame[i] >> 8;
+        }
+        return n;
+    #endif
+}
+
+
+bool hal_led_show(const uint32_t* frame, uint32_t n) {
+    if (led_busy || (n == 0))
+        return false;
+    led_busy = true;
+    led_done_us = now_us + n * HOST_LED_US_PER_WORD + LEDSTRIP_RESET_US;
+
+    uint32_t n_pixels = __led_pixels(frame, n);
+    if (led_sink)
+        led_sink(now_us, led_grb, n_pixels);
+    return true;
+}
+
+bool hal_led_busy() {
+    return led_busy;
+}
+
+
+void hal_led_timer_start(uint32_t period_us, hal_led_timer_callback_t callback) {
+    if (led_timer_callback)
+        return;
+    led_timer_callback = callback;
+    led_timer_period_us = period_us;
+    led_timer_next_us = now_us + period_us;
+}
+
+void hal_led_timer_stop() {
+    led_timer_callback = NULL;
+}
+
+
+static void __led_service() {
+    if (led_busy && (now_us >= led_done_us)) {
+        led_busy = false;
+        if (led_done)
+            led_done();
+    }
+
+    while (led_timer_callback && (now_us >= led_timer_next_us)) {
+        led_timer_next_us += led_timer_period_us;
+        if (!led_timer_callback())
+            led_timer_callback = NULL;
+    }
+}
+
+
+void host_set_led_sink(host_led_sink_t sink) {
+    led_sink = sink;
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ FLASH ----------------------------------------
+static const uint8_t* font_partition;
+
+
+const uint8_t* hal_font_partition() {
+    return font_partition;
+}
+
+void host_set_font_partition(const uint8_t* part) {
+    font_partition = part;
+}
+// -----------------------------------------------------------------------------
+
+
+// Deliver the interrupts that are due, as the NVIC would
+static void __service() {
+    // Interrupts don't nest
+    if (!irq_enabled || dormant || in_irq)
+        return;
+    in_irq = true;
+
+    for (uint8_t pin = 0; pin < HOST_N_GPIOS; pin++) {
+        if (gpio_pending[pin]) {
+            gpio_pending[pin] = false;
+            gpio_callbacks[pin]();
+        }
+    }
+
+    __i2c_service();
+    __audio_service();
+    __cores_service();
+    __led_service();
+
+    while (tick_enabled && (now_us >= next_tick_us)) {
+        next_tick_us += 1000;
+        isr_tick();
+    }
+
+    in_irq = false;
+}
+
+
+// Back to power on: idle inputs, no peripherals set up
+void host_reset() {
+    now_us = 0;
+    step_hook = NULL;
+    exit_requested = false;
+    dormant = false;
+    irq_enabled = true;
+    in_irq = false;
+    host_seed(1);
+
+    tick_enabled = false;
+
+    memset(gpio_callbacks, 0, sizeof(gpio_callbacks));
+    memset(gpio_pending, 0, sizeof(gpio_pending));
+    memset(gpio_level, 0, sizeof(gpio_level));
+    // Pulled up on the board
+    gpio_level[PIN_BTN] = 1;
+    gpio_level[PIN_IMU_INT] = 1;
+    wakeup_edge = false;
+
+    current_core = 0;
+    core0_fifo_n = 0;
+
+    __imu_power_on_reset();
+    i2c_busy = false;
+    i2c_baud = 0;
+
+    audio_running = false;
+    audio_callback = NULL;
+    audio_sink = NULL;
+    led_sink = NULL;
+    led_done = NULL;
+    led_busy = false;
+    led_timer_callback = NULL;
+    font_partition = NULL;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file hal_host.h
+ * @brief Hardware abstraction layer, host implementation
+ *
+ * Fake peripherals behind `hal.h` for running the firmware on a PC. Time is
+ * virtual: it only moves on when the firmware waits (`hal_idle()`,
+ * `hal_sleep_ms()`, `hal_go_dormant()`) or the caller advances it. The 1 ms
+ * tick, the audio interrupt and GPIO edges are delivered synchronously from
+ * there, so a run is fully deterministic. Core 1 only runs when core 0 sends
+ * it a message, as if it had been waiting for it.
+ *
+ * Anything driving the firmware (a simulator, a test) uses the functions
+ * below to feed the inputs and to collect the speaker and LED strip output.
+ */
+
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Granularity of virtual time while the firmware busy-waits
+#define HOST_STEP_US            10
+
+
+// ------------------------------ TIME -----------------------------------------
+// Called on every step of virtual time, before any interrupt is delivered, to
+// feed inputs (button, IMU) at the right moment
+typedef void (*host_step_hook_t)(uint64_t now_us);
+
+void host_reset();                      // Call first, and between runs
+void host_set_step_hook(host_step_hook_t hook);
+
+uint64_t host_time_us();
+void host_advance_us(uint64_t us);
+
+// Make hal_go_dormant() return without waiting for a wakeup edge, so that a
+// run can be wound down
+void host_request_exit();
+bool host_exit_requested();
+
+void host_seed(uint32_t seed);          // Seed for hal_rand_bit()
+// -----------------------------------------------------------------------------
+
+// ------------------------------ GPIO -----------------------------------------
+// Drive an input pin. A falling edge calls back the firmware if it asked for
+// it.
+void host_gpio_set(uint8_t pin, bool value);
+bool host_gpio_level(uint8_t pin);      // Level of any pin, input or output
+// -----------------------------------------------------------------------------
+
+// ------------------------------ IMU ------------------------------------------
+// The MPU-6050 behind the I2C bus is a register file, with the FIFO. Motion
+// data registers are big endian as on the chip. Interrupt sources are the
+// MPU6050_INT_* bits of imu.h.
+
+// Feed one sample per millisecond, the accelerometer output rate, in +-2 g
+// and +-250 dps units. Values out of the int16 range are kept, and only
+// saturate once scaled to the full scale ranges the firmware configured.
+// The sample also goes to the FIFO at the SMPLRT_DIV rate, and through the
+// motion and zero-motion detection; returns the interrupt sources raised, if
+// any.
+uint8_t host_imu_set_sample(const int32_t accel[3], const int32_t gyro[3]);
+
+// Raise interrupt sources (INT_STATUS bits), along with MOT_DETECT_STATUS.
+// Only sources enabled in INT_ENABLE pull the INT pin low, until INT_STATUS
+// is read if the interrupt is latched, else for a pulse.
+void host_imu_interrupt(uint8_t int_status, uint8_t mot_detect_status);
+
+uint8_t host_imu_reg(uint8_t reg);
+// -----------------------------------------------------------------------------
+
+// ------------------------------ OUTPUTS --------------------------------------
+// Called with every half-buffer of PWM compare values once it has been played,
+// and when it started playing
+typedef void (*host_audio_sink_t)(uint64_t t_us, const uint16_t* levels,
+                                  uint32_t n);
+void host_set_audio_sink(host_audio_sink_t sink);
+
+// Called with every frame sent to the LED strip, strand after strand with
+// LEDSTRIP_N_STRANDS
+typedef void (*host_led_sink_t)(uint64_t t_us, const uint32_t* grb,
+                                uint32_t n);
+void host_set_led_sink(host_led_sink_t sink);
+// -----------------------------------------------------------------------------
+
+// ------------------------------ FLASH ----------------------------------------
+// Contents of the font partition, or NULL for none
+void host_set_font_partition(const uint8_t* part);
+// -----------------------------------------------------------------------------
+
+
+#endif /* HAL_HOST_H */
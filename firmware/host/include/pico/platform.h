@@ -0,0 +1,17 @@
+/**
+ * @file platform.h
+ * @brief Stand-in for the Pico SDK header included by the `tunes_xxx.h` files
+ */
+
+
+#ifndef PICO_PLATFORM_H
+#define PICO_PLATFORM_H
+
+
+#include <stdint.h>
+
+// There is no separate flash section on the host
+#define __in_flash(...)
+
+
+#endif /* PICO_PLATFORM_H */
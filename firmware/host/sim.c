@@ -0,0 +1,405 @@
+/**
+ * @file sim.c
+ * @brief Saber simulator
+ *
+ * Runs the firmware main loop on the host, in virtual time, against a
+ * recorded motion trace. The trace is a CSV file with one row per sample
+ *
+ *      t_ms,ax,ay,az,gx,gy,gz[,btn]
+ *
+ * with raw MPU-6050 readings (+-2 g, +-250 dps full scale) and btn 1 while
+ * the button is held. Readings may go past the int16 range, for the firmware
+ * to see with a wider full scale range. A row holds until the next one; a missing btn keeps the
+ * previous state. Lines starting with anything but a digit are skipped.
+ *
+ * The speaker output is written as a 16-bit WAV file at the playback rate,
+ * every frame sent to the LED strip to a CSV file, and the motion interrupts
+ * the IMU raised to stdout, with the count of late, dropped and dimmed LED
+ * frames, the peak estimated LED current after and before dimming, and the
+ * time at each system clock level with its estimated board current at the
+ * end.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "pinmap.h"
+#include "font.h"
+#include "imu.h"
+#include "ledstrip.h"
+#include "clocks.h"
+#include "hal_host.h"
+
+
+// Keep going for this long after the last row, for sounds to finish
+#define SIM_DEFAULT_TAIL_MS     2000
+
+// UF2 container, see https://github.com/microsoft/uf2
+#define SIM_UF2_MAGIC_START0    0x0a324655
+#define SIM_UF2_MAGIC_START1    0x9e5d5157
+#define SIM_UF2_BLOCK_SIZE      512
+#define SIM_XIP_BASE            0x10000000
+// Each UF2 block carries 256 bytes of a 512 byte block
+#define SIM_FONT_FILE_MAX       (2 * FONT_FLASH_SIZE + SIM_UF2_BLOCK_SIZE)
+
+
+int firmware_main();
+
+
+typedef struct {
+    uint32_t t_ms;
+    int32_t accel[3];
+    int32_t gyro[3];
+    int8_t btn;                         // -1 to keep the previous state
+} sim_row_t;
+
+
+static sim_row_t* rows;
+static size_t n_rows;
+static size_t row_idx;
+static bool btn_down;
+
+static uint64_t end_us;
+static jmp_buf sim_done;
+
+static int16_t* wav;
+static size_t wav_len;
+static size_t wav_cap;
+
+static FILE* led_file;
+
+
+// ------------------------------ INPUTS ---------------------------------------
+static bool __load_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    size_t cap = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (!isdigit((unsigned char) line[0]))
+            continue;
+
+        sim_row_t r;
+        int v[8];
+        int n = sscanf(line, "%d,%d,%d,%d,%d,%d,%d,%d",
+                       &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+        if (n < 7) {
+            fprintf(stderr, "%s: bad row: %s", path, line);
+            fclose(f);
+            return false;
+        }
+
+        r.t_ms = (uint32_t) v[0];
+        for (uint8_t i = 0; i < 3; i++) {
+            r.accel[i] = v[1 + i];
+            r.gyro[i] = v[4 + i];
+        }
+        r.btn = (n > 7) ? (v[7] != 0) : -1;
+
+        if (n_rows == cap) {
+            cap = cap ? 2 * cap : 1024;
+            rows = realloc(rows, cap * sizeof(sim_row_t));
+        }
+        rows[n_rows++] = r;
+    }
+
+    fclose(f);
+    if (n_rows == 0) {
+        fprintf(stderr, "%s: no samples\n", path);
+        return false;
+    }
+    return true;
+}
+
+
+// Unpack the blocks of a UF2 file that land in the font partition
+static bool __unpack_uf2(uint8_t* part, const uint8_t* uf2, size_t len) {
+    bool any = false;
+
+    for (size_t off = 0; off + SIM_UF2_BLOCK_SIZE <= len; off += SIM_UF2_BLOCK_SIZE) {
+        uint32_t hdr[8];
+        memcpy(hdr, uf2 + off, sizeof(hdr));
+        if ((hdr[0] != SIM_UF2_MAGIC_START0) || (hdr[1] != SIM_UF2_MAGIC_START1))
+            return false;
+
+        uint32_t addr = hdr[3];
+        uint32_t size = hdr[4];
+        uint32_t base = SIM_XIP_BASE + FONT_FLASH_OFFSET;
+        if ((size > SIM_UF2_BLOCK_SIZE - 32) || (addr < base)
+            || (addr - base + size > FONT_FLASH_SIZE))
+            continue;
+
+        memcpy(part + (addr - base), uf2 + off + 32, size);
+        any = true;
+    }
+    return any;
+}
+
+
+// Read a font partition, either the .uf2 from `wav2pwm.py --font` or a raw
+// image, padded out like erased flash
+static uint8_t* __load_font(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    uint8_t* buf = malloc(SIM_FONT_FILE_MAX);
+    size_t n = fread(buf, 1, SIM_FONT_FILE_MAX, f);
+    fclose(f);
+
+    uint8_t* part = malloc(FONT_FLASH_SIZE);
+    memset(part, 0xff, FONT_FLASH_SIZE);
+
+    uint32_t magic = 0;
+    if (n >= 4)
+        memcpy(&magic, buf, 4);
+
+    bool ok;
+    if (magic == SIM_UF2_MAGIC_START0) {
+        ok = __unpack_uf2(part, buf, n);
+    } else {
+        ok = (n > 0) && (n <= FONT_FLASH_SIZE);
+        if (ok)
+            memcpy(part, buf, n);
+    }
+    free(buf);
+
+    if (!ok) {
+        fprintf(stderr, "%s: not a font partition image\n", path);
+        free(part);
+        return NULL;
+    }
+    return part;
+}
+
+
+static void __log(uint64_t t_us, const char* what) {
+    printf("%10.3f ms  %s\n", t_us / 1000.0, what);
+}
+
+
+// Feed the trace to the fake button and IMU, one sample per millisecond
+static void __step(uint64_t now_us) {
+    if (now_us >= end_us)
+        longjmp(sim_done, 1);
+
+    if (now_us % 1000)
+        return;
+
+    uint64_t now_ms = now_us / 1000;
+    while ((row_idx + 1 < n_rows) && (rows[row_idx + 1].t_ms <= now_ms)) {
+        row_idx++;
+    }
+    const sim_row_t* r = &rows[row_idx];
+
+    if ((r->t_ms <= now_ms) && (r->btn >= 0) && (r->btn != btn_down)) {
+        btn_down = r->btn;
+        __log(now_us, btn_down ? "button down" : "button up");
+        // Active low
+        host_gpio_set(PIN_BTN, !btn_down);
+    }
+
+    uint8_t raised = host_imu_set_sample(r->accel, r->gyro);
+    if (raised & MPU6050_INT_MOT)
+        __log(now_us, "IMU motion (clash)");
+    if (raised & MPU6050_INT_ZMOT) {
+        if (host_imu_reg(MPU6050_REG_MOT_DETECT_STATUS) & 0x01)
+            __log(now_us, "IMU zero-motion");
+        else
+            __log(now_us, "IMU motion after zero-motion (swing)");
+    }
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ OUTPUTS --------------------------------------
+static void __wav_put(size_t idx, int16_t sample) {
+    if (idx >= wav_cap) {
+        wav_cap = (idx + 1) * 2;
+        wav = realloc(wav, wav_cap * sizeof(int16_t));
+    }
+    // Silence over any gap while the audio was stopped
+    while (wav_len < idx) {
+        wav[wav_len++] = 0;
+    }
+    wav[idx] = sample;
+    if (idx >= wav_len)
+        wav_len = idx + 1;
+}
+
+
+// One 16-bit sample per SPK_N_REPETITIONS PWM compare values, averaged as
+// the speaker would: noise shaped, they differ
+static void __audio_sink(uint64_t t_us, const uint16_t* levels, uint32_t n) {
+    size_t idx = (size_t) (t_us * SPK_SAMPLE_RATE / 1000000);
+    for (uint32_t i = 0; i < n; i += SPK_N_REPETITIONS) {
+        int32_t sum = 0;
+        for (uint32_t r = 0; r < SPK_N_REPETITIONS; r++) {
+            uint16_t level = levels[i + r];
+            sum += (level > SPK_PWM_COUNT_TOP) ? SPK_PWM_COUNT_TOP : level;
+        }
+        int32_t sample = (sum << (16 - SPK_PWM_BITS)) / SPK_N_REPETITIONS - 32768;
+        __wav_put(idx++, (int16_t) sample);
+    }
+}
+
+
+static void __led_sink(uint64_t t_us, const uint32_t* grb, uint32_t n) {
+    fprintf(led_file, "%.3f", t_us / 1000.0);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t r = (grb[i] >> 8) & 0xff;
+        uint32_t g = (grb[i] >> 16) & 0xff;
+        uint32_t b = grb[i] & 0xff;
+        fprintf(led_file, ",%02x%02x%02x", r, g, b);
+    }
+    fprintf(led_file, "\n");
+}
+
+
+static void __put_le(FILE* f, uint32_t v, uint8_t n_bytes) {
+    for (uint8_t i = 0; i < n_bytes; i++) {
+        fputc((v >> (8 * i)) & 0xff, f);
+    }
+}
+
+
+static bool __write_wav(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    // Up to the end of the run
+    size_t n = (size_t) (end_us * SPK_SAMPLE_RATE / 1000000);
+    if (n > 0)
+        __wav_put(n - 1, (n <= wav_len) ? wav[n - 1] : 0);
+
+    fwrite("RIFF", 1, 4, f);
+    __put_le(f, 36 + 2 * n, 4);
+    fwrite("WAVEfmt ", 1, 8, f);
+    __put_le(f, 16, 4);                 // fmt chunk size
+    __put_le(f, 1, 2);                  // PCM
+    __put_le(f, 1, 2);                  // Mono
+    __put_le(f, SPK_SAMPLE_RATE, 4);
+    __put_le(f, 2 * SPK_SAMPLE_RATE, 4);    // Bytes per second
+    __put_le(f, 2, 2);                  // Block align
+    __put_le(f, 16, 2);                 // Bits per sample
+    fwrite("data", 1, 4, f);
+    __put_le(f, 2 * n, 4);
+    for (size_t i = 0; i < n; i++) {
+        __put_le(f, (uint16_t) wav[i], 2);
+    }
+
+    fclose(f);
+    return true;
+}
+// -----------------------------------------------------------------------------
+
+
+static void __usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-f font.uf2] [-w out.wav] [-l leds.csv] [-s seed] "
+            "[-t tail_ms] trace.csv\n", prog);
+}
+
+
+int main(int argc, char** argv) {
+    const char* font_path = NULL;
+    const char* wav_path = "momentum_sim.wav";
+    const char* led_path = NULL;
+    uint32_t seed = 1;
+    uint32_t tail_ms = SIM_DEFAULT_TAIL_MS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:w:l:s:t:h")) != -1) {
+        switch (opt) {
+            case 'f': font_path = optarg; break;
+            case 'w': wav_path = optarg; break;
+            case 'l': led_path = optarg; break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            case 't': tail_ms = strtoul(optarg, NULL, 0); break;
+            default:
+                __usage(argv[0]);
+                return (opt == 'h') ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1) {
+        __usage(argv[0]);
+        return 2;
+    }
+
+    if (!__load_trace(argv[optind]))
+        return 1;
+
+    host_reset();
+    host_seed(seed);
+
+    if (font_path) {
+        uint8_t* part = __load_font(font_path);
+        if (part == NULL)
+            return 1;
+        host_set_font_partition(part);
+    }
+
+    if (led_path) {
+        led_file = fopen(led_path, "w");
+        if (led_file == NULL) {
+            perror(led_path);
+            return 1;
+        }
+        host_set_led_sink(__led_sink);
+    }
+
+    host_set_audio_sink(__audio_sink);
+    host_set_step_hook(__step);
+    end_us = ((uint64_t) rows[n_rows - 1].t_ms + tail_ms) * 1000;
+
+    // The firmware never returns; the step hook jumps back here at the end of
+    // the trace
+    if (setjmp(sim_done) == 0) {
+        firmware_main();
+    }
+
+    if (font_get() == NULL)
+        fprintf(stderr, "warning: no sound font, the speaker stayed silent\n");
+
+    ledstrip_stats_t led_stats;
+    ledstrip_get_stats(&led_stats);
+    printf("LED strip: %u frames, %u late, %u dropped, %u dimmed, peak %u mA "
+           "(%u mA requested)\n",
+           (unsigned) led_stats.frames, (unsigned) led_stats.late,
+           (unsigned) led_stats.dropped, (unsigned) led_stats.limited,
+           (unsigned) led_stats.peak_ma, (unsigned) led_stats.peak_requested_ma);
+
+    static const char* const level_names[CLOCKS_N_LEVELS] = {
+        "idle", "normal", "boost"
+    };
+    static const uint32_t level_khz[CLOCKS_N_LEVELS] = SYS_CLK_LEVEL_KHZ;
+    clocks_stats_t clk_stats;
+    clocks_get_stats(&clk_stats);
+    printf("System clock: %u switches, %.2f mA average\n",
+           (unsigned) clk_stats.switches, clk_stats.avg_ua / 1000.0);
+    for (uint8_t l = 0; l < CLOCKS_N_LEVELS; l++) {
+        printf("  %-6s %7.3f MHz %8u ms %6.2f mA\n", level_names[l],
+               level_khz[l] / 1000.0, (unsigned) clk_stats.ms[l],
+               clk_stats.ua[l] / 1000.0);
+    }
+
+    if (led_file)
+        fclose(led_file);
+    if (!__write_wav(wav_path))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,78 @@
+/**
+ * @file adpcm.h
+ * @brief IMA-ADPCM decoder
+ *
+ * Sounds are stored as a sequence of ADPCM_BLOCK_BYTES blocks, as emitted by
+ * `wav2pwm.py --adpcm`. Each block starts with a 4-byte header
+ *      int16_t predictor   (little endian)
+ *      uint8_t step index
+ *      uint8_t reserved
+ * giving the decoder state before the block's first sample, followed by
+ * 4-bit codes, two samples per byte, low nibble first. Every block can be
+ * decoded on its own, so a sound can loop or restart at any block boundary.
+ */
+
+
+#ifndef ADPCM_H
+#define ADPCM_H
+
+
+#include <stdint.h>
+
+
+#define ADPCM_BLOCK_BYTES       256
+#define ADPCM_HEADER_BYTES      4
+#define ADPCM_BLOCK_SAMPLES     (2 * (ADPCM_BLOCK_BYTES - ADPCM_HEADER_BYTES))
+
+
+typedef struct {
+    int32_t predictor;
+    int32_t index;
+} adpcm_state_t;
+
+
+extern const int16_t ADPCM_STEP_TABLE[89];
+extern const int8_t ADPCM_INDEX_TABLE[16];
+
+
+// Load the decoder state from the header of the block at blk
+static inline void adpcm_block_start(adpcm_state_t* st, const uint8_t* blk) {
+    st->predictor = (int16_t) (blk[0] | (blk[1] << 8));
+    st->index = blk[2];
+    if (st->index > 88)
+        st->index = 88;
+}
+
+// Decode one 4-bit code
+static inline int16_t adpcm_decode(adpcm_state_t* st, uint8_t code) {
+    int32_t step = ADPCM_STEP_TABLE[st->index];
+
+    int32_t diff = step >> 3;
+    if (code & 4) diff += step;
+    if (code & 2) diff += step >> 1;
+    if (code & 1) diff += step >> 2;
+
+    int32_t pred = st->predictor;
+    if (code & 8)
+        pred -= diff;
+    else
+        pred += diff;
+
+    if (pred > INT16_MAX)
+        pred = INT16_MAX;
+    else if (pred < INT16_MIN)
+        pred = INT16_MIN;
+    st->predictor = pred;
+
+    int32_t index = st->index + ADPCM_INDEX_TABLE[code];
+    if (index < 0)
+        index = 0;
+    else if (index > 88)
+        index = 88;
+    st->index = index;
+
+    return (int16_t) pred;
+}
+
+
+#endif /* ADPCM_H */
@@ -4,67 +4,31 @@
  */
 
 
-#include "pico/stdlib.h"
-#include "hardware/sync.h"
-
+#include "hal.h"
 #include "button.h"
 #include "pinmap.h"
+#include "trace.h"
+#include "events.h"
 
 
-volatile bool __has_short_press = false;
-volatile bool __has_long_press = false;
 volatile uint32_t __press_count = 0;
 volatile bool __btn_prev_down = false;
-volatile bool __long_press_handled = false;
 volatile uint32_t __btn_debounce_count = BTN_DEBOUNCE_TICK_COUNT;
 volatile bool __btn_pressed = false;
 volatile bool __btn_prev_pressed = false;
 
 
 void btn_init() {
-    gpio_init(PIN_BTN);
-    gpio_set_dir(PIN_BTN, GPIO_IN);
+    hal_gpio_init(PIN_BTN, false);
     // Board has physical pull-up
     //gpio_pull_up(PIN_BTN);
 }
 
 
-void btn_clear_press() {
-    uint32_t status = save_and_disable_interrupts();
-    __has_short_press = false;
-    __has_long_press = false;
-    restore_interrupts(status);
-}
-
-
-bool btn_has_short_press() {
-    bool flag = false;
-    uint32_t status = save_and_disable_interrupts();
-    if (__has_short_press) {
-        __has_short_press = false;
-        flag = true;
-    }
-    restore_interrupts(status);
-    return flag;
-}
-
-
-bool btn_has_long_press() {
-    bool flag = false;
-    uint32_t status = save_and_disable_interrupts();
-    if (__has_long_press) {
-        __has_long_press = false;
-        __long_press_handled = true;
-        flag = true;
-    }
-    restore_interrupts(status);
-    return flag;
-}
-
-
+// Call in a millisecond interrupt. Presses are posted to the event queue.
 void btn_handler() {
 
-    bool btn_down = (gpio_get(PIN_BTN) == 0) ? true : false;
+    bool btn_down = (hal_gpio_get(PIN_BTN) == 0) ? true : false;
 
     // If the button state just changed, restart debouncing
     if (btn_down != __btn_prev_down) {
@@ -85,20 +49,25 @@ void btn_handler() {
     if (__btn_pressed) {
         __press_count++;
 
-        if ( (__press_count >= BTN_LONG_PRESS_MS) &&
-             (!__long_press_handled) ) {
-            __has_long_press = true;
+        // Each only once per press, however long the button is held
+        if (__press_count == BTN_LONG_PRESS_MS) {
+            TRACE(TRACE_BTN_LONG, 0);
+            events_post(EVENT_BTN_LONG, 0);
+        }
+        if (__press_count == BTN_EXTRA_LONG_PRESS_MS) {
+            TRACE(TRACE_BTN_EXTRA_LONG, 0);
+            events_post(EVENT_BTN_EXTRA_LONG, 0);
         }
     } else {        
         // If button is debounced to not pressed and press count isn't too
         // high, we have a short press
         if ( (__btn_prev_pressed) &&
              (__press_count < BTN_LONG_PRESS_MS) ) {
-            __has_short_press = true;
+            TRACE(TRACE_BTN_SHORT, 0);
+            events_post(EVENT_BTN_SHORT, 0);
         }
 
         __press_count = 0;
-        __long_press_handled = false;
     }
 
     __btn_prev_down = btn_down;
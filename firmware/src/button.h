@@ -8,7 +8,7 @@
 #define BUTTON_H_
 
 
-#include "pico/stdlib.h"
+#include <stdbool.h>
 
 
 #define BTN_DEBOUNCE_TICK_COUNT     10
@@ -17,14 +17,12 @@
 #define BTN_SHORT_PRESS_MS  10
 // Number of milliseconds minimum for a long press
 #define BTN_LONG_PRESS_MS   1000
+// Number of milliseconds minimum for an extra long press, reported in
+// addition to the long press when the button is held on
+#define BTN_EXTRA_LONG_PRESS_MS 3000
 
 
 void btn_init();
-
-void btn_clear_press();
-bool btn_has_short_press();
-bool btn_has_long_press();
-
 void btn_handler();
 
 
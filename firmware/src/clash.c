@@ -0,0 +1,109 @@
+/**
+ * @file clash.c
+ * @brief Clash detector on the accelerometer samples
+ */
+
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "utilities.h"
+#include "clash.h"
+
+
+#if defined(CLASH_DETECT_MCU) && !defined(IMU_FIFO_MODE)
+    #error "CLASH_DETECT_MCU needs IMU_FIFO_MODE for the accelerometer samples"
+#endif
+
+// Accelerometer LSB per g at the full scale range in use
+#define CLASH_LSB_PER_G     (16384 >> IMU_FIFO_ACCEL_FS_SEL)
+
+// Thresholds from g/s to LSB per sample
+#define CLASH_THRESH        ((CLASH_JERK_THRESH_GPS * CLASH_LSB_PER_G) / IMU_FIFO_ODR_HZ)
+#define CLASH_RELEASE       ((CLASH_JERK_RELEASE_GPS * CLASH_LSB_PER_G) / IMU_FIFO_ODR_HZ)
+
+#define CLASH_REFRACTORY    ((CLASH_REFRACTORY_MS * IMU_FIFO_ODR_HZ) / 1000)
+
+// High-pass coefficient RC / (RC + dt), Q15
+#define CLASH_HPF_A         ((int32_t) (32768.0 / (1.0 + 6.2831853 * CLASH_HPF_HZ \
+                                                         / IMU_FIFO_ODR_HZ)))
+
+#if CLASH_RELEASE >= CLASH_THRESH
+    #error "CLASH_JERK_RELEASE_GPS must be below CLASH_JERK_THRESH_GPS"
+#endif
+
+
+static int16_t prev_in[3];
+static int16_t hpf_out[3];
+static bool primed;
+static bool armed;
+static uint32_t refractory;
+
+
+static inline int16_t __sat16(int32_t v) {
+    if (v > INT16_MAX)
+        return INT16_MAX;
+    if (v < INT16_MIN)
+        return INT16_MIN;
+    return (int16_t) v;
+}
+
+
+void clash_reset() {
+    for (uint8_t k = 0; k < 3; k++) {
+        prev_in[k] = 0;
+        hpf_out[k] = 0;
+    }
+    primed = false;
+    armed = true;
+    refractory = 0;
+}
+
+
+// High-pass one sample, returning the jerk magnitude
+static uint32_t __jerk(const imu_sample_t* s) {
+    // The first sample only sets the filter state, or gravity would look
+    // like a step
+    if (!primed) {
+        for (uint8_t k = 0; k < 3; k++) {
+            prev_in[k] = s->accel[k];
+        }
+        primed = true;
+        return 0;
+    }
+
+    uint32_t sq = 0;
+    for (uint8_t k = 0; k < 3; k++) {
+        int32_t x = s->accel[k];
+        int16_t y = __sat16((CLASH_HPF_A
+            * __sat16((int32_t) hpf_out[k] + x - prev_in[k])) >> 15);
+        int32_t j = __sat16((int32_t) y - hpf_out[k]);
+
+        prev_in[k] = (int16_t) x;
+        hpf_out[k] = y;
+        sq += (uint32_t) (j * j);
+    }
+    return isqrt32(sq);
+}
+
+
+uint32_t clash_update(const imu_sample_t* samples, uint32_t n) {
+    uint32_t clash = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t jerk = __jerk(&samples[i]);
+
+        if (refractory > 0)
+            refractory--;
+
+        if (!armed) {
+            if (jerk < CLASH_RELEASE)
+                armed = true;
+        } else if ((jerk > CLASH_THRESH) && (refractory == 0)) {
+            armed = false;
+            refractory = CLASH_REFRACTORY;
+            clash = jerk;
+        }
+    }
+    return clash;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file clash.h
+ * @brief Clash detector on the accelerometer samples
+ *
+ * Detects clashes on the MCU from the samples streamed through the IMU FIFO,
+ * rather than with the motion interrupt of the IMU. Each sample goes through
+ * a first order high-pass to drop gravity and slow moves, then the magnitude
+ * of its change from the previous sample, the jerk, is compared against a
+ * threshold:
+ *  - a clash is detected when the jerk goes above CLASH_JERK_THRESH_GPS,
+ *  - the detector re-arms once it has fallen back below
+ *    CLASH_JERK_RELEASE_GPS (hysteresis),
+ *  - and not before CLASH_REFRACTORY_MS after the last clash.
+ *
+ * Arithmetic is Q15 and saturating, in the accelerometer units of
+ * IMU_FIFO_ACCEL_FS_SEL.
+ */
+
+
+#ifndef CLASH_H
+#define CLASH_H
+
+
+#include <stdint.h>
+
+#include "imu.h"
+
+
+void clash_reset();
+
+// Run the detector over n samples. Returns the jerk that set off a clash in
+// them, in LSB per sample, or 0 if there was none.
+uint32_t clash_update(const imu_sample_t* samples, uint32_t n);
+
+
+#endif /* CLASH_H */
@@ -0,0 +1,217 @@
+/**
+ * @file clock_plan.h
+ * @brief System clock and speaker PWM divider for each audio format
+ *
+ * Generated by util/clockplan.py, do not edit. Included by config.h.
+ */
+
+
+#ifndef CLOCK_PLAN_H
+#define CLOCK_PLAN_H
+
+
+// Options the plans were made with
+#define CLOCK_PLAN_MIN_KHZ          27000
+#define CLOCK_PLAN_IDLE_KHZ         18000
+#define CLOCK_PLAN_BOOST_KHZ        48000
+#define CLOCK_PLAN_TOLERANCE_PPM    2000
+#define CLOCK_PLAN_MIN_CARRIER_HZ   40000
+
+#if (SPK_SAMPLE_RATE == 8000) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 8)
+    // 828.000 MHz VCO / 6 / 5, PWM / 1.6875: -1736 ppm
+    #define SYS_CLK_FREQ_KHZ        27600
+    #define SYS_PLL_VCO_KHZ         828000
+    #define SYS_PLL_POSTDIV1        6
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     11
+    #define SPK_RATE_ERROR_PPM      -1736
+    // Levels: 25.600 MHz (+0 ppm), 27.600 MHz (-1736 ppm), 49.200 MHz (+977 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 25600, 27600, 49200 }
+    #define SYS_CLK_LEVEL_PLANS     { { 768000, 6, 5, 1, 9 }, { 828000, 6, 5, 1, 11 }, { 984000, 5, 4, 3, 0 } }
+#elif (SPK_SAMPLE_RATE == 8000) && (SPK_PWM_BITS == 10) && (SPK_N_REPETITIONS == 8)
+    // 1572.000 MHz VCO / 6 / 4, PWM / 1: -549 ppm
+    #define SYS_CLK_FREQ_KHZ        65500
+    #define SYS_PLL_VCO_KHZ         1572000
+    #define SYS_PLL_POSTDIV1        6
+    #define SYS_PLL_POSTDIV2        4
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      -549
+    // Levels: 65.500 MHz (-549 ppm), 65.500 MHz (-549 ppm), 65.500 MHz (-549 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 65500, 65500, 65500 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1572000, 6, 4, 1, 0 }, { 1572000, 6, 4, 1, 0 }, { 1572000, 6, 4, 1, 0 } }
+#elif (SPK_SAMPLE_RATE == 8000) && (SPK_PWM_BITS == 11) && (SPK_N_REPETITIONS == 8)
+    // 1572.000 MHz VCO / 4 / 3, PWM / 1: -549 ppm
+    #define SYS_CLK_FREQ_KHZ        131000
+    #define SYS_PLL_VCO_KHZ         1572000
+    #define SYS_PLL_POSTDIV1        4
+    #define SYS_PLL_POSTDIV2        3
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      -549
+    // Levels: 131.000 MHz (-549 ppm), 131.000 MHz (-549 ppm), 131.000 MHz (-549 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 131000, 131000, 131000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1572000, 4, 3, 1, 0 }, { 1572000, 4, 3, 1, 0 }, { 1572000, 4, 3, 1, 0 } }
+#elif (SPK_SAMPLE_RATE == 22050) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 2)
+    // 888.000 MHz VCO / 6 / 5, PWM / 2.625: -1188 ppm
+    #define SYS_CLK_FREQ_KHZ        29600
+    #define SYS_PLL_VCO_KHZ         888000
+    #define SYS_PLL_POSTDIV1        6
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      2
+    #define SPK_PWM_CLKDIV_FRAC     10
+    #define SPK_RATE_ERROR_PPM      -1188
+    // Levels: 24.000 MHz (+400 ppm), 29.600 MHz (-1188 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 24000, 29600, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 840000, 7, 5, 2, 2 }, { 888000, 6, 5, 2, 10 }, { 768000, 4, 4, 4, 4 } }
+#elif (SPK_SAMPLE_RATE == 22050) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 4)
+    // 888.000 MHz VCO / 6 / 5, PWM / 1.3125: -1188 ppm
+    #define SYS_CLK_FREQ_KHZ        29600
+    #define SYS_PLL_VCO_KHZ         888000
+    #define SYS_PLL_POSTDIV1        6
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     5
+    #define SPK_RATE_ERROR_PPM      -1188
+    // Levels: 24.000 MHz (+400 ppm), 29.600 MHz (-1188 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 24000, 29600, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 840000, 7, 5, 1, 1 }, { 888000, 6, 5, 1, 5 }, { 768000, 4, 4, 2, 2 } }
+#elif (SPK_SAMPLE_RATE == 22050) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 8)
+    // 1128.000 MHz VCO / 5 / 5, PWM / 1: -850 ppm
+    #define SYS_CLK_FREQ_KHZ        45120
+    #define SYS_PLL_VCO_KHZ         1128000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      -850
+    // Levels: 45.120 MHz (-850 ppm), 45.120 MHz (-850 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 45120, 45120, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1128000, 5, 5, 1, 0 }, { 1128000, 5, 5, 1, 0 }, { 768000, 4, 4, 1, 1 } }
+#elif (SPK_SAMPLE_RATE == 22050) && (SPK_PWM_BITS == 10) && (SPK_N_REPETITIONS == 2)
+    // 1128.000 MHz VCO / 5 / 5, PWM / 1: -850 ppm
+    #define SYS_CLK_FREQ_KHZ        45120
+    #define SYS_PLL_VCO_KHZ         1128000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      -850
+    // Levels: 45.120 MHz (-850 ppm), 45.120 MHz (-850 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 45120, 45120, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1128000, 5, 5, 1, 0 }, { 1128000, 5, 5, 1, 0 }, { 768000, 4, 4, 1, 1 } }
+#elif (SPK_SAMPLE_RATE == 22050) && (SPK_PWM_BITS == 10) && (SPK_N_REPETITIONS == 4)
+    // 1356.000 MHz VCO / 5 / 3, PWM / 1: +921 ppm
+    #define SYS_CLK_FREQ_KHZ        90400
+    #define SYS_PLL_VCO_KHZ         1356000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        3
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      921
+    // Levels: 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 90400, 90400, 90400 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 } }
+#elif (SPK_SAMPLE_RATE == 22050) && (SPK_PWM_BITS == 11) && (SPK_N_REPETITIONS == 2)
+    // 1356.000 MHz VCO / 5 / 3, PWM / 1: +921 ppm
+    #define SYS_CLK_FREQ_KHZ        90400
+    #define SYS_PLL_VCO_KHZ         1356000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        3
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      921
+    // Levels: 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 90400, 90400, 90400 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 1)
+    // 888.000 MHz VCO / 6 / 5, PWM / 2.625: -1188 ppm
+    #define SYS_CLK_FREQ_KHZ        29600
+    #define SYS_PLL_VCO_KHZ         888000
+    #define SYS_PLL_POSTDIV1        6
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      2
+    #define SPK_PWM_CLKDIV_FRAC     10
+    #define SPK_RATE_ERROR_PPM      -1188
+    // Levels: 24.000 MHz (+400 ppm), 29.600 MHz (-1188 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 24000, 29600, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 840000, 7, 5, 2, 2 }, { 888000, 6, 5, 2, 10 }, { 768000, 4, 4, 4, 4 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 2)
+    // 888.000 MHz VCO / 6 / 5, PWM / 1.3125: -1188 ppm
+    #define SYS_CLK_FREQ_KHZ        29600
+    #define SYS_PLL_VCO_KHZ         888000
+    #define SYS_PLL_POSTDIV1        6
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     5
+    #define SPK_RATE_ERROR_PPM      -1188
+    // Levels: 24.000 MHz (+400 ppm), 29.600 MHz (-1188 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 24000, 29600, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 840000, 7, 5, 1, 1 }, { 888000, 6, 5, 1, 5 }, { 768000, 4, 4, 2, 2 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 4)
+    // 1128.000 MHz VCO / 5 / 5, PWM / 1: -850 ppm
+    #define SYS_CLK_FREQ_KHZ        45120
+    #define SYS_PLL_VCO_KHZ         1128000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      -850
+    // Levels: 45.120 MHz (-850 ppm), 45.120 MHz (-850 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 45120, 45120, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1128000, 5, 5, 1, 0 }, { 1128000, 5, 5, 1, 0 }, { 768000, 4, 4, 1, 1 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 8) && (SPK_N_REPETITIONS == 8)
+    // 1356.000 MHz VCO / 5 / 3, PWM / 1: +921 ppm
+    #define SYS_CLK_FREQ_KHZ        90400
+    #define SYS_PLL_VCO_KHZ         1356000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        3
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      921
+    // Levels: 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 90400, 90400, 90400 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 10) && (SPK_N_REPETITIONS == 1)
+    // 1128.000 MHz VCO / 5 / 5, PWM / 1: -850 ppm
+    #define SYS_CLK_FREQ_KHZ        45120
+    #define SYS_PLL_VCO_KHZ         1128000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        5
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      -850
+    // Levels: 45.120 MHz (-850 ppm), 45.120 MHz (-850 ppm), 48.000 MHz (+400 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 45120, 45120, 48000 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1128000, 5, 5, 1, 0 }, { 1128000, 5, 5, 1, 0 }, { 768000, 4, 4, 1, 1 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 10) && (SPK_N_REPETITIONS == 2)
+    // 1356.000 MHz VCO / 5 / 3, PWM / 1: +921 ppm
+    #define SYS_CLK_FREQ_KHZ        90400
+    #define SYS_PLL_VCO_KHZ         1356000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        3
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      921
+    // Levels: 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 90400, 90400, 90400 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 } }
+#elif (SPK_SAMPLE_RATE == 44100) && (SPK_PWM_BITS == 11) && (SPK_N_REPETITIONS == 1)
+    // 1356.000 MHz VCO / 5 / 3, PWM / 1: +921 ppm
+    #define SYS_CLK_FREQ_KHZ        90400
+    #define SYS_PLL_VCO_KHZ         1356000
+    #define SYS_PLL_POSTDIV1        5
+    #define SYS_PLL_POSTDIV2        3
+    #define SPK_PWM_CLKDIV_INT      1
+    #define SPK_PWM_CLKDIV_FRAC     0
+    #define SPK_RATE_ERROR_PPM      921
+    // Levels: 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm), 90.400 MHz (+921 ppm)
+    #define SYS_CLK_LEVEL_KHZ       { 90400, 90400, 90400 }
+    #define SYS_CLK_LEVEL_PLANS     { { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 }, { 1356000, 5, 3, 1, 0 } }
+#else
+    #error "No clock plan for this sample rate, SPK_PWM_BITS and SPK_N_REPETITIONS, see util/clockplan.py"
+#endif
+
+
+#endif /* CLOCK_PLAN_H */
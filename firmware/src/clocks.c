@@ -0,0 +1,145 @@
+/**
+ * @file clocks.c
+ * @brief System clock governor
+ */
+
+
+#include "hal.h"
+#include "config.h"
+
+#include "clocks.h"
+#include "tick.h"
+#include "speaker.h"
+#include "effects.h"
+#include "events.h"
+#include "imu.h"
+#include "trace.h"
+
+
+static const uint32_t __khz[CLOCKS_N_LEVELS] = SYS_CLK_LEVEL_KHZ;
+
+static clocks_level_t __level;
+static bool __awake;
+static uint32_t __since_us;             // Start of the time at __level
+static uint32_t __busy_us;              // Last time the workload needed it
+static uint64_t __level_us[CLOCKS_N_LEVELS];
+static uint32_t __switches;
+static volatile uint32_t __ticks;
+
+
+static inline uint32_t __estimate_ua(clocks_level_t level) {
+    return SYS_CLK_BASE_UA + (__khz[level] * SYS_CLK_UA_PER_MHZ) / 1000;
+}
+
+
+// Add the time at the current level up to now
+static void __account(uint32_t now_us) {
+    if (__awake)
+        __level_us[__level] += now_us - __since_us;
+    __since_us = now_us;
+}
+
+
+static void __set_level(clocks_level_t level) {
+    __account(hal_time_us());
+    tick_set_clock(hal_sys_set_clock(level));
+    // An IMU interrupt during the switch found the bus taken
+    imu_resume_interrupts();
+    __level = level;
+    __switches++;
+    TRACE(TRACE_SYS_CLOCK, level);
+}
+
+
+#ifdef SYS_CLK_SCALING
+// The lowest level the mixer and the blade can keep up at
+static clocks_level_t __workload() {
+    if (effects_active_above(EFFECT_LAYER_AUDIO)) {
+        #if N_LEDSTRIP_LEDS * LEDSTRIP_N_STRANDS >= SYS_CLK_BOOST_MIN_LEDS
+            return CLOCKS_BOOST;
+        #else
+            return CLOCKS_NORMAL;
+        #endif
+    }
+    if (!spk_is_only_humming())
+        return CLOCKS_NORMAL;
+    return CLOCKS_IDLE;
+}
+#endif
+
+
+void clocks_init() {
+    // hal_sys_init() set up the normal level
+    __level = CLOCKS_NORMAL;
+    __awake = true;
+    __since_us = hal_time_us();
+    __busy_us = __since_us;
+    for (uint8_t l = 0; l < CLOCKS_N_LEVELS; l++) {
+        __level_us[l] = 0;
+    }
+    __switches = 0;
+    __ticks = 0;
+}
+
+
+void clocks_tick() {
+    #ifdef SYS_CLK_SCALING
+        if (++__ticks >= SYS_CLK_GOVERNOR_MS) {
+            __ticks = 0;
+            events_post(EVENT_CLOCKS, 0);
+        }
+    #endif
+}
+
+
+void clocks_update() {
+    #ifdef SYS_CLK_SCALING
+        clocks_level_t level = __workload();
+        uint32_t now_us = hal_time_us();
+
+        if (level >= __level) {
+            __busy_us = now_us;
+            if (level > __level)
+                __set_level(level);
+        } else if (now_us - __busy_us >= SYS_CLK_HOLD_MS * 1000) {
+            __busy_us = now_us;
+            __set_level(level);
+        }
+    #endif
+}
+
+
+void clocks_sleep() {
+    if (__level != CLOCKS_NORMAL)
+        __set_level(CLOCKS_NORMAL);
+    __account(hal_time_us());
+    __awake = false;
+}
+
+
+void clocks_wake() {
+    __awake = true;
+    __since_us = hal_time_us();
+    __busy_us = __since_us;
+}
+
+
+clocks_level_t clocks_level() {
+    return __level;
+}
+
+
+void clocks_get_stats(clocks_stats_t* stats) {
+    __account(hal_time_us());
+
+    uint64_t total_ms = 0;
+    uint64_t sum = 0;
+    for (uint8_t l = 0; l < CLOCKS_N_LEVELS; l++) {
+        stats->ms[l] = (uint32_t) (__level_us[l] / 1000);
+        stats->ua[l] = __estimate_ua(l);
+        total_ms += stats->ms[l];
+        sum += (uint64_t) stats->ms[l] * stats->ua[l];
+    }
+    stats->avg_ua = total_ms ? (uint32_t) (sum / total_ms) : 0;
+    stats->switches = __switches;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file clocks.h
+ * @brief System clock governor
+ *
+ * With SYS_CLK_SCALING, the system clock follows the workload, between the
+ * levels planned by util/clockplan.py for the audio format:
+ *  - idle while only the hum is mixed and the blade is steady,
+ *  - normal for any other sound, SmoothSwing loops included, or blade
+ *    effects on a short blade,
+ *  - boost for blade effects over the steady blade (blast, lockup, flash)
+ *    on a blade of at least SYS_CLK_BOOST_MIN_LEDS.
+ * The main loop checks the workload after each event, and every
+ * SYS_CLK_GOVERNOR_MS from the tick. A higher level is switched to at once,
+ * a lower one after SYS_CLK_HOLD_MS of lighter workload. The tick is
+ * restarted at the new clock; the HAL sets the rest, see hal_sys_set_clock().
+ *
+ * The time awake at each level is kept for tuning, with an estimate of the
+ * board current at each, see SYS_CLK_BASE_UA and SYS_CLK_UA_PER_MHZ.
+ */
+
+
+#ifndef CLOCKS_H
+#define CLOCKS_H
+
+
+#include <stdint.h>
+
+
+// In SYS_CLK_LEVEL_PLANS order
+typedef enum {
+    CLOCKS_IDLE,
+    CLOCKS_NORMAL,                      // SYS_CLK_FREQ_KHZ, set up on boot
+    CLOCKS_BOOST,
+    CLOCKS_N_LEVELS
+} clocks_level_t;
+
+// Since clocks_init()
+typedef struct {
+    uint32_t ms[CLOCKS_N_LEVELS];       // Awake at each level
+    uint32_t ua[CLOCKS_N_LEVELS];       // Estimated board current at each
+    uint32_t avg_ua;                    // Estimated over the time awake
+    uint32_t switches;
+} clocks_stats_t;
+
+
+void clocks_init();
+void clocks_tick();                     // From the 1 ms tick
+void clocks_update();                   // From the main loop, core 0
+
+// Around sys_go_dormant(): back to the normal level, which the wakeup sets
+// up again, and the time asleep left out
+void clocks_sleep();
+void clocks_wake();
+
+clocks_level_t clocks_level();
+void clocks_get_stats(clocks_stats_t* stats);
+
+
+#endif /* CLOCKS_H */
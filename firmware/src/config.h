@@ -21,29 +21,103 @@
 // -----------------------------------------------------------------------------
 
 // ------------------------------ SOUNDS ---------------------------------------
-// Select which `tunes_xxx.h` file to use. These files should have a poweron,
-// poweroff, hum, and multiple swing/clash sounds comprising a length and a 
-// uint8_t array. Use the audio conversion script to generate `tunes_xxx.h` 
-// files from a set of WAV files.
+// Sound fonts are normally loaded from a binary font image, flashed on its own
+// at FONT_FLASH_OFFSET. Use the audio conversion script with `--font` to
+// build a `.uf2` of a font from a set of WAV files; it can be flashed over
+// the firmware without rebuilding it.
 //
-// If none are defined, the original sounds used in development will be used,
-// which have only a single swing/clash sound.
+// Offset of the font partition in flash. The firmware itself must end below
+// this, which it does unless a set of 8-bit PCM tunes is compiled in below.
+#define FONT_FLASH_OFFSET       (1024 * 1024)
+#define FONT_FLASH_SIZE         (2 * 1024 * 1024 - FONT_FLASH_OFFSET)
+
+// Optionally, select a `tunes_xxx.h` file to compile in as a fallback for when
+// no font image is found. These files should have a poweron, poweroff, hum,
+// and multiple swing/clash sounds comprising a length and a uint8_t array.
+// Use the audio conversion script to generate `tunes_xxx.h` files from a set
+// of WAV files.
 //
 // This does not impact how the main loop handles playing different swing/clash
 // sounds for different motions (if there is any capability of doing such),
 // but the definition can be used in the main loop too to configure this.
-// Uncomment only one!
+// Uncomment at most one!
 //#define TUNES_USE_EP4                   // Dark side suitable
-#define TUNES_USE_OBS                   // Normal-sounding
+//#define TUNES_USE_OBS                   // Normal-sounding
 //#define TUNES_USE_CLASSIC               // Also normal-sounding, hum too quiet
 //#define TUNES_USE_OBS_CLASSICPWR          // Classic poweron/off, obs others
-// Nothing uncommented -- use original poweron and poweroff but with obs sounds
+// Nothing uncommented -- only play a flashed font image
 
 // Playback frquency of the audio samples
 // Uncomment only one!
 //#define TUNE_22KHZ
 //#define TUNE_8KHZ
 #define TUNE_44KHZ
+
+#ifdef TUNE_22KHZ
+    #define SPK_SAMPLE_RATE     22050
+#elif defined(TUNE_8KHZ)
+    #define SPK_SAMPLE_RATE     8000
+#else
+    #define SPK_SAMPLE_RATE     44100
+#endif
+
+// Uncomment for SmoothSwing-style swing sounds, which needs IMU_FIFO_MODE.
+// The angular speed from the gyro continuously sets the volume of a pair of
+// looped swing sounds over the hum, crossfading from one to the other as
+// the blade turns and bending the hum pitch up. The swing sounds of the font
+// are used as loops; the zero-motion swing event is then ignored.
+//#define SMOOTHSWING_ENABLE
+
+// Below this angular speed the swing loops are silent, and they are at full
+// volume from the sensitivity up
+#define SMOOTHSWING_THRESHOLD_DPS       20
+#define SMOOTHSWING_SENSITIVITY_DPS     450
+// Rotation over which one loop fades into the other
+#define SMOOTHSWING_TRANSITION_DEG      180
+// Q8 share of the hum gain taken away at full swing
+#define SMOOTHSWING_HUM_DUCK            128
+// Hum rate added at full swing, Q16 (3277 is +5%)
+#define SMOOTHSWING_PITCH_BEND          3277
+// Low pass on the angular speed, time constant of 2^n IMU samples
+#define SMOOTHSWING_SMOOTH_SHIFT        3
+
+// Number of voices the software mixer sums together. The hum, power, swing
+// and clash sounds each get their own voice, so the hum keeps playing under
+// motion sounds. SmoothSwing adds two for its loops.
+#ifdef SMOOTHSWING_ENABLE
+    #define MIXER_N_VOICES      6
+#else
+    #define MIXER_N_VOICES      4
+#endif
+
+// Number of audio samples per mixer block. The speaker keeps two blocks and
+// mixes into one while the other is played out, so this is also roughly the
+// latency from a motion event to its sound.
+#define SPK_BLOCK_SIZE          128
+
+// Per-voice gains, Q8 (256 is unity). The mixed output saturates.
+#define SPK_GAIN_POWER          256
+#define SPK_GAIN_HUM            256
+#define SPK_GAIN_HUM_DUCKED     160     // Hum gain while a swing/clash plays
+#define SPK_GAIN_SWING          256
+#define SPK_GAIN_CLASH          256
+
+// Envelope of the output, for the LEDs: the RMS of each block is followed by
+// 1 / 2^shift of the way per block, rising and falling
+#define SPK_ENV_ATTACK_SHIFT    1
+#define SPK_ENV_RELEASE_SHIFT   3
+
+// Uncomment to take that envelope from the envelope tracks of the font at the
+// playback position of each sound instead, which costs nothing per block.
+// Needs a font built by a `wav2pwm.py` with envelope tracks (font version 2);
+// sounds without a track then count as silent.
+//#define SPK_ENV_FROM_TRACKS
+
+// Uncomment to noise shape the speaker output down to SPK_PWM_BITS: each PWM
+// level carries the rounding error of the last one (first-order error
+// feedback) with a triangular dither of one level, which moves the hiss of
+// quiet sounds up in frequency, toward the PWM carrier
+//#define SPK_NOISE_SHAPING
 // -----------------------------------------------------------------------------
 
 // ----------------------------- MOTION ----------------------------------------
@@ -67,23 +141,95 @@
 #define IMU_THRESH_SWING        144
 // Duration for swing detection, in units of 64 ms
 #define IMU_N_SWING_DUR         8
+
+// Uncomment to also stream accelerometer and gyro samples through the IMU
+// FIFO, for processing on the MCU. The IMU pulses its INT pin on every
+// sample; every IMU_FIFO_BURST of those, the FIFO is read out in one burst.
+// The motion interrupts above still work, but are only picked up once per
+// burst.
+//#define IMU_FIFO_MODE
+
+// Sample rate, dividing the 1 kHz gyro output rate
+#define IMU_FIFO_ODR_HZ         500
+// Samples per FIFO read. The latency of motion interrupts is up to this many
+// sample periods.
+#define IMU_FIFO_BURST          8
+// Full scale ranges in FIFO mode. 0 to 3 for +-2, 4, 8, 16 g and +-250,
+// 500, 1000, 2000 dps
+#define IMU_FIFO_ACCEL_FS_SEL   3
+#define IMU_FIFO_GYRO_FS_SEL    3
+// Samples kept for the main loop, power of 2
+#define IMU_SAMPLE_BUFFER_LEN   64
+
+// Uncomment to detect clashes on the MCU from the FIFO samples, see clash.h,
+// instead of with the IMU motion interrupt. Needs IMU_FIFO_MODE.
+//#define CLASH_DETECT_MCU
+
+// High-pass cutoff ahead of the jerk, in Hz
+#define CLASH_HPF_HZ            10
+// Jerk magnitude setting off a clash, and below which the detector re-arms,
+// in g/s
+#define CLASH_JERK_THRESH_GPS   1500
+#define CLASH_JERK_RELEASE_GPS  500
+// No other clash for this long after one
+#define CLASH_REFRACTORY_MS     150
 // -----------------------------------------------------------------------------
 
 // ----------------------------- LED STRIP -------------------------------------
-// Number of WS2812B LEDs in the strip.
+// Number of WS2812B LEDs in the strip. Strands wired to the same data pin
+// show the same frame, so count the LEDs of one.
 #define N_LEDSTRIP_LEDS         25
 
+// Strands on their own pins, from PIN_LEDSTRIP_STRANDS, clocked out together
+// by one PIO state machine. Up to 8; 1 drives PIN_LEDSTRIP alone.
+#define LEDSTRIP_N_STRANDS      1
+
+// WS2812B bit rate, and the time the data line is held low for the strip to
+// latch a frame
+#define LEDSTRIP_BIT_RATE_HZ    800000
+#define LEDSTRIP_RESET_US       300
+
+// Gamma of the LEDs, and their duty at full scale out of 255, which sets the
+// current. Colors are perceptual, see gamma.h.
+#define LEDSTRIP_GAMMA          2.2f
+#define LEDSTRIP_BRIGHTNESS     160
+
+// Current governor: frames estimated above the budget, for all strands, are
+// dimmed to it. WS2812B draw per channel at full duty and per LED at rest.
+#define LEDSTRIP_CURRENT_BUDGET_MA  600
+#define LEDSTRIP_MA_PER_CHANNEL     20
+#define LEDSTRIP_IDLE_UA_PER_LED    1000
+
+// Render tick rate cap. Frames go out no faster, and slower if the strip
+// takes longer to send (24 bits per LED, then the reset time).
+#define LEDSTRIP_MAX_FPS        100
+
 // Flash LED strip on a clash motion?
 //#define LEDSTRIP_FLASH_ON_CLASH
 
-// Number of milliseconds it takes for one LED to turn on / off during strip
-// turning on or off
+// Flicker the lit blade, dimming it by up to LEDSTRIP_FLICKER_DEPTH / 255
+//#define LEDSTRIP_FLICKER
+#define LEDSTRIP_FLICKER_DEPTH  32
+
+// Follow the sound on the blade: dimmed by up to LEDSTRIP_AUDIO_DEPTH / 255
+// in silence, full at an output envelope of LEDSTRIP_AUDIO_FULL_RMS, so that
+// it pulses with the hum and flares on clashes
+//#define LEDSTRIP_AUDIO_REACTIVE
+#define LEDSTRIP_AUDIO_DEPTH    96
+#define LEDSTRIP_AUDIO_FULL_RMS 16384
+
+// Blaster bolt deflections: a spot this many LEDs wide each side, fading out
+// over this long
+#define LEDSTRIP_BLAST_WIDTH    ((N_LEDSTRIP_LEDS + 7) / 8)
+#define LEDSTRIP_BLAST_MS       250
+
+// Number of milliseconds it takes for the whole blade to turn on / off
 #ifdef SABER_POWERONOFF_SLOW
-    #define N_LEDSTRIP_TURN_ON_MS   30
-    #define N_LEDSTRIP_TURN_OFF_MS  30
+    #define LEDSTRIP_TURN_ON_MS     750
+    #define LEDSTRIP_TURN_OFF_MS    750
 #else 
-    #define N_LEDSTRIP_TURN_ON_MS   30
-    #define N_LEDSTRIP_TURN_OFF_MS  30
+    #define LEDSTRIP_TURN_ON_MS     750
+    #define LEDSTRIP_TURN_OFF_MS    750
 #endif
 
 // Maximum number of flashes to do when a clash is detected, as a power of 2
@@ -105,36 +251,81 @@
 // ---------------------------- SYSTEM -----------------------------------------
 #define SYS_POWERON_DELAY       1600        // ms, should > poweron tune length
 
-#define SYS_CLK_FREQ_KHZ        27000 // 108000    // 27000
+// Events from the interrupts waiting for the main loop. Power of 2.
+#define EVENT_QUEUE_LEN         16
 
-#define SPK_PWM_COUNT_TOP       255         // 8-bit audio, wrap at 8-bit top
+// Run the speaker (audio interrupt and mixer) and the motion processing on
+// core 1, leaving core 0 to the main loop, tick, LED strip and IMU bus. See
+// cores.h. Comment out to run everything on core 0.
+#define SYS_DUAL_CORE
 
-// At 44.1 kHz PWM frequency and 4 repetitions
+// Speaker PWM resolution: 8 bits, or 10 or 11 for less hiss, best with 16-bit
+// or ADPCM sounds and SPK_NOISE_SHAPING. The PWM wraps every 2^bits cycles,
+// so more bits need a faster system clock to keep the carrier out of hearing.
+#define SPK_PWM_BITS            8
 
-#define SPK_N_REPETITIONS       2           // N times audio sample is repeated
-// Default clock of 125 MHz / 256 = 488 kHz, divided by 22 kHz desired sample
-// rate is ~ 22.195. For N_REPETITIONS, the desired sample rate is multiplied
-// by that number, so the clock divider is by default 22.0 / N_REPETITIONS
-// 
-// With N_REPETITIONS = 4, the minimum system frequency is 
-//      22 kHz * 4 * 256 = 22.528 MHz.
-//
-// Page 230 of RP2040 datasheet provides a script to find achievable PLL
-// output frequencies. However, with 12MHz crystal, the minimum allowed VCO
-// frequency is 756 MHz, achieved with a multiplication ratio of 63. 
-// So we can run at 756 MHz / (some integer between 1 and 49) using the post
-// dividers for lowest power consumption while > 22.528 MHz. For example, 
-// 756 MHz / 28 = 27.0 MHz, and then the PWM clock divider should be 1.1985
-//
-// For now, use 27 MHz clock regardless of PWM frequency, and just modify
-// this divisor
-#define SPK_PWM_CLKDIV      1.1958f
-
-//#ifdef TUNE_22KHZ
-//    #define SPK_PWM_CLKDIV      1.1985f //22.0f / SPK_N_REPETITIONS
-//#elif defined TUNE_8KHZ
-//    #define SPK_PWM_CLKDIV      3.2959f //88.0f / SPK_N_REPETITIONS
-//#endif
+#define SPK_PWM_COUNT_TOP       ((1 << SPK_PWM_BITS) - 1)
+
+// Times each audio sample is repeated in the PWM: the carrier is at the
+// sample rate times this, kept above SPK_PWM_CARRIER_MIN_HZ
+#if SPK_SAMPLE_RATE == 8000
+    #define SPK_N_REPETITIONS   8
+#elif SPK_PWM_BITS == 8
+    #define SPK_N_REPETITIONS   2
+#else
+    #define SPK_N_REPETITIONS   1
+#endif
+
+// The system clock and the PWM divider are planned from the sample rate,
+// SPK_PWM_BITS and SPK_N_REPETITIONS by util/clockplan.py, into clock_plan.h:
+// the lowest system clock of at least SYS_CLK_MIN_KHZ that plays within
+// SPK_RATE_TOLERANCE_PPM of the sample rate with a carrier of at least
+// SPK_PWM_CARRIER_MIN_HZ, from the lowest PLL VCO that makes it. A format
+// without such a plan fails the build. Rerun the script with these as its
+// options after changing them.
+#define SYS_CLK_MIN_KHZ         27000
+#define SPK_RATE_TOLERANCE_PPM  2000
+#define SPK_PWM_CARRIER_MIN_HZ  40000
+
+// Uncomment to scale the system clock with the workload, see clocks.h: down
+// to a plan from SYS_CLK_IDLE_MIN_KHZ while the saber only hums, up to one
+// from SYS_CLK_BOOST_MIN_KHZ for blade effects on a blade of at least
+// SYS_CLK_BOOST_MIN_LEDS (all strands), and the above otherwise. Without
+// it, the clock stays at the one above.
+//#define SYS_CLK_SCALING
+#define SYS_CLK_IDLE_MIN_KHZ    18000
+#define SYS_CLK_BOOST_MIN_KHZ   48000
+#define SYS_CLK_BOOST_MIN_LEDS  100
+#define SYS_CLK_GOVERNOR_MS     20          // Workload checked this often
+#define SYS_CLK_HOLD_MS         200         // Before scaling back down
+
+// Estimated board current, apart from the LED strip and the speaker, for
+// the clock statistics: SYS_CLK_BASE_UA plus SYS_CLK_UA_PER_MHZ for each MHz
+// of system clock. Measure the board at each level to tune them.
+#define SYS_CLK_BASE_UA         3000
+#define SYS_CLK_UA_PER_MHZ      220
+
+#include "clock_plan.h"
+
+#if (CLOCK_PLAN_MIN_KHZ != SYS_CLK_MIN_KHZ) \
+    || (CLOCK_PLAN_IDLE_KHZ != SYS_CLK_IDLE_MIN_KHZ) \
+    || (CLOCK_PLAN_BOOST_KHZ != SYS_CLK_BOOST_MIN_KHZ) \
+    || (CLOCK_PLAN_TOLERANCE_PPM != SPK_RATE_TOLERANCE_PPM) \
+    || (CLOCK_PLAN_MIN_CARRIER_HZ != SPK_PWM_CARRIER_MIN_HZ)
+    #error "clock_plan.h was planned with other options, rerun util/clockplan.py"
+#endif
+
+// Uncomment to record timestamped events (IMU interrupt, main loop, audio,
+// LED strip, button) and print them over the UART each time the saber turns
+// off. See trace.h. Costs a little time in every probe, and clk_peri stays on.
+//#define TRACE_ENABLE
+#define TRACE_BUFFER_LEN        512         // Events kept, oldest dropped
+
+// Uncomment to also record every LED frame sent and latched, for the frame
+// times of trace_latency.py. Two events per frame fill the buffer within
+// seconds, pushing out the motion events; late, dropped and dimmed frames
+// are recorded either way.
+//#define TRACE_LED_FRAMES
 
 // MPU-6050 I2C configuration
 #define IMU_I2C_CLK_FREQ_KHZ    400
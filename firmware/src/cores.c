@@ -0,0 +1,128 @@
+/**
+ * @file cores.c
+ * @brief Split of the work between the two cores
+ */
+
+
+#include "hal.h"
+#include "config.h"
+#include "cores.h"
+#include "speaker.h"
+#include "motion.h"
+#include "events.h"
+
+
+#ifdef SYS_DUAL_CORE
+
+// A message word: the message in the top byte, whether core 0 waits for it,
+// then up to 16 bits of argument
+#define CORES_MSG(msg, arg)     (((uint32_t) (msg) << 24) | (arg))
+#define CORES_SYNC              (1u << 23)
+#define CORES_MSG_OF(word)      ((word) >> 24)
+#define CORES_ARG_OF(word)      ((word) & 0xffff)
+
+static volatile bool launched = false;
+
+// Calls sent from the main loop, and the ones core 1 has done
+static uint32_t calls_sent = 0;
+static volatile uint32_t calls_done = 0;
+
+
+static void __send(uint32_t word) {
+    while (!hal_core_send(word)) {
+        hal_idle();
+    }
+}
+
+
+// Core 1, from the SIO interrupt
+static void __core1_handler(uint32_t word) {
+    uint8_t arg = CORES_ARG_OF(word);
+
+    switch (CORES_MSG_OF(word)) {
+        case CORES_MSG_SPK:
+            spk_command(arg);
+            break;
+
+        case CORES_MSG_MOTION_RESET:
+            motion_reset();
+            break;
+
+        case CORES_MSG_IMU_DATA:
+            if (motion_process())
+                events_post(EVENT_CLASH, 0);
+            break;
+
+        default:
+            break;
+    }
+
+    if (word & CORES_SYNC)
+        calls_done++;
+}
+
+
+// Core 0, from the SIO interrupt
+static void __core0_handler(uint32_t word) {
+    if (CORES_MSG_OF(word) == CORES_MSG_EVENT)
+        events_post((event_type_t) ((word >> 8) & 0xff), word & 0xff);
+}
+
+
+void cores_launch() {
+    hal_core1_launch(spk_init, __core1_handler, __core0_handler);
+    launched = true;
+}
+
+
+bool cores_call(cores_msg_t msg, uint8_t arg) {
+    if (!launched || (hal_core_num() != 0))
+        return false;
+
+    calls_sent++;
+    __send(CORES_MSG(msg, arg) | CORES_SYNC);
+    while (calls_done != calls_sent) {
+        hal_idle();
+    }
+    return true;
+}
+
+
+bool cores_notify(cores_msg_t msg, uint8_t arg) {
+    if (!launched || (hal_core_num() != 0))
+        return false;
+
+    // Dropped if core 1 is that far behind; it takes every sample there is
+    // on the next one anyway
+    hal_core_send(CORES_MSG(msg, arg));
+    return true;
+}
+
+
+bool cores_post_event(uint8_t type, uint8_t arg) {
+    if (!launched || (hal_core_num() != 1))
+        return false;
+
+    __send(CORES_MSG(CORES_MSG_EVENT, ((uint32_t) type << 8) | arg));
+    return true;
+}
+
+#else
+
+void cores_launch() {
+    spk_init();
+}
+
+bool cores_call(cores_msg_t msg, uint8_t arg) {
+    return false;
+}
+
+bool cores_notify(cores_msg_t msg, uint8_t arg) {
+    return false;
+}
+
+bool cores_post_event(uint8_t type, uint8_t arg) {
+    return false;
+}
+
+#endif /* SYS_DUAL_CORE */
@@ -0,0 +1,55 @@
+/**
+ * @file cores.h
+ * @brief Split of the work between the two cores
+ *
+ * With SYS_DUAL_CORE, core 1 owns the speaker, meaning the audio interrupt
+ * and the mixer, and the motion processing on the IMU samples. Core 0 keeps
+ * the main loop: buttons, LED strip, IMU bus and power management. The 1 ms
+ * tick then never waits behind a mixer block.
+ *
+ * The cores talk through the SIO FIFOs, one word per message:
+ *  - core 0 calls into the speaker and the motion processing are carried
+ *    out by core 1 instead, and core 0 waits until they are done, so that
+ *    they behave as plain function calls,
+ *  - new IMU samples are signalled to core 1 without waiting, from the I2C
+ *    interrupt,
+ *  - events posted on core 1 are handed to core 0, which queues them. The
+ *    event queue keeps a single producer side.
+ *
+ * Without SYS_DUAL_CORE everything runs on core 0 as before, and none of the
+ * functions below do anything.
+ */
+
+
+#ifndef CORES_H
+#define CORES_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+typedef enum {
+    CORES_MSG_SPK,                  // arg: SPK_CMD_*, see speaker.h
+    CORES_MSG_MOTION_RESET,
+    CORES_MSG_IMU_DATA,             // New samples from the IMU FIFO
+    CORES_MSG_EVENT,                // To core 0, arg: event_t
+} cores_msg_t;
+
+
+// Start core 1, which sets up the speaker. Call once, in place of spk_init().
+void cores_launch();
+
+// Have core 1 carry out a call made on core 0, and wait for it. Returns false
+// when the caller should carry it out itself: in a single core build, or on
+// core 1.
+bool cores_call(cores_msg_t msg, uint8_t arg);
+
+// Signal core 1 without waiting, from an interrupt. Returns false as above.
+bool cores_notify(cores_msg_t msg, uint8_t arg);
+
+// Hand an event posted on core 1 to core 0. Returns false on core 0.
+bool cores_post_event(uint8_t type, uint8_t arg);
+
+
+#endif /* CORES_H */
@@ -0,0 +1,233 @@
+/**
+ * @file effects.c
+ * @brief Blade effects and their compositor
+ */
+
+
+#include <string.h>
+
+#include "config.h"
+#include "utilities.h"
+#include "ledstrip.h"
+#include "speaker.h"
+#include "effects.h"
+
+
+static effect_t __effects[EFFECT_N_LAYERS];
+static effect_pixel_t __layer[N_LEDSTRIP_LEDS];
+
+// Flicker and blasts only need to look random, and are drawn every frame:
+// xorshift rather than the ring oscillator bits
+static uint32_t __rand_state = 0x2545f491;
+
+
+static inline uint32_t __rand() {
+    __rand_state ^= __rand_state << 13;
+    __rand_state ^= __rand_state >> 17;
+    __rand_state ^= __rand_state << 5;
+    return __rand_state;
+}
+
+
+void effects_reset() {
+    memset(__effects, 0, sizeof(__effects));
+}
+
+
+effect_t* effects_start(effect_layer_t layer, effect_render_t render,
+                        led_color_t color, uint32_t now_ms) {
+    effect_t* e = &__effects[layer];
+    memset(e, 0, sizeof(effect_t));
+    e->render = render;
+    e->start_ms = now_ms;
+    e->color = color;
+    return e;
+}
+
+void effects_stop(effect_layer_t layer) {
+    __effects[layer].render = NULL;
+}
+
+void effects_set_color(effect_layer_t layer, led_color_t color) {
+    __effects[layer].color = color;
+}
+
+bool effects_running(effect_layer_t layer, effect_render_t render) {
+    return __effects[layer].render == render;
+}
+
+bool effects_active_above(effect_layer_t layer) {
+    for (uint8_t l = layer + 1; l < EFFECT_N_LAYERS; l++) {
+        if (__effects[l].render)
+            return true;
+    }
+    return false;
+}
+
+bool effects_active() {
+    for (uint8_t l = 0; l < EFFECT_N_LAYERS; l++) {
+        if (__effects[l].render)
+            return true;
+    }
+    return false;
+}
+
+
+static inline uint16_t __mix(uint16_t d, uint16_t s, uint32_t a) {
+    return (uint16_t) (((uint32_t) s * a + (uint32_t) d * (65536 - a)) >> 16);
+}
+
+
+// src over dst
+static inline void __blend(led_color_t* dst, const effect_pixel_t* src) {
+    uint32_t a = src->a;
+    if (a == 0)
+        return;
+    if (a == EFFECT_OPAQUE) {
+        *dst = src->c;
+        return;
+    }
+
+    a += a >> 15;
+    dst->g = __mix(dst->g, src->c.g, a);
+    dst->r = __mix(dst->r, src->c.r, a);
+    dst->b = __mix(dst->b, src->c.b, a);
+}
+
+
+uint32_t effects_render(uint32_t now_ms, led_color_t* line) {
+    memset(line, 0, N_LEDSTRIP_LEDS * sizeof(led_color_t));
+
+    for (uint8_t l = 0; l < EFFECT_N_LAYERS; l++) {
+        effect_t* e = &__effects[l];
+        if (e->render == NULL)
+            continue;
+
+        memset(__layer, 0, sizeof(__layer));
+        if (!e->render(e, now_ms - e->start_ms, __layer))
+            e->render = NULL;
+
+        for (uint32_t i = 0; i < N_LEDSTRIP_LEDS; i++) {
+            __blend(&line[i], &__layer[i]);
+        }
+    }
+
+    uint32_t lit = 0;
+    for (uint32_t i = 0; i < N_LEDSTRIP_LEDS; i++) {
+        if (line[i].g | line[i].r | line[i].b)
+            lit++;
+    }
+    return lit;
+}
+
+
+// ------------------------------ EFFECTS --------------------------------------
+static inline void __fill(effect_pixel_t* layer, uint32_t from, uint32_t to,
+                          led_color_t color, uint16_t alpha) {
+    for (uint32_t i = from; i < to; i++) {
+        layer[i].c = color;
+        layer[i].a = alpha;
+    }
+}
+
+
+bool effect_ignition(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    uint32_t lit = N_LEDSTRIP_LEDS;
+    if (t_ms < LEDSTRIP_TURN_ON_MS)
+        lit = (t_ms * N_LEDSTRIP_LEDS) / LEDSTRIP_TURN_ON_MS;
+    __fill(layer, 0, lit, e->color, EFFECT_OPAQUE);
+    return true;
+}
+
+
+bool effect_retraction(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    if (t_ms >= LEDSTRIP_TURN_OFF_MS)
+        return false;
+    uint32_t lit = N_LEDSTRIP_LEDS - (t_ms * N_LEDSTRIP_LEDS) / LEDSTRIP_TURN_OFF_MS;
+    __fill(layer, 0, lit, e->color, EFFECT_OPAQUE);
+    return lit > 0;
+}
+
+
+bool effect_flicker(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    uint32_t alpha = (__rand() % (LEDSTRIP_FLICKER_DEPTH + 1)) * 257;
+    __fill(layer, 0, N_LEDSTRIP_LEDS, LED_COLOR(LEDSTRIP_COLOR_OFF), alpha);
+    return true;
+}
+
+
+bool effect_audio(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    uint32_t env = spk_envelope();
+    if (env > LEDSTRIP_AUDIO_FULL_RMS)
+        env = LEDSTRIP_AUDIO_FULL_RMS;
+    uint32_t alpha = (LEDSTRIP_AUDIO_DEPTH * 257 * (LEDSTRIP_AUDIO_FULL_RMS - env))
+                     / LEDSTRIP_AUDIO_FULL_RMS;
+    __fill(layer, 0, N_LEDSTRIP_LEDS, LED_COLOR(LEDSTRIP_COLOR_OFF), alpha);
+    return true;
+}
+
+
+bool effect_blast(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    if (t_ms >= LEDSTRIP_BLAST_MS)
+        return false;
+
+    // Somewhere along the outer three quarters of the blade
+    if (!e->on) {
+        e->pos = N_LEDSTRIP_LEDS / 4 + __rand() % (N_LEDSTRIP_LEDS - N_LEDSTRIP_LEDS / 4);
+        e->on = true;
+    }
+
+    uint32_t peak = (EFFECT_OPAQUE * (LEDSTRIP_BLAST_MS - t_ms)) / LEDSTRIP_BLAST_MS;
+    for (uint32_t i = 0; i < N_LEDSTRIP_LEDS; i++) {
+        uint32_t d = (i > e->pos) ? i - e->pos : e->pos - i;
+        if (d < LEDSTRIP_BLAST_WIDTH) {
+            uint32_t alpha = (peak * (LEDSTRIP_BLAST_WIDTH - d)) / LEDSTRIP_BLAST_WIDTH;
+            layer[i].c = e->color;
+            layer[i].a = alpha;
+        }
+    }
+    return true;
+}
+
+
+bool effect_lockup(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    uint32_t alpha = EFFECT_OPAQUE / 2 + __rand() % (EFFECT_OPAQUE / 2 + 1);
+    __fill(layer, 0, N_LEDSTRIP_LEDS, e->color, alpha);
+    return true;
+}
+
+
+// Flashes shorter than a frame would never be seen
+static uint32_t __flash_ms(uint8_t n_bits_min, uint8_t n_bits_max) {
+    uint32_t ms = rand_powof2_range(n_bits_min, n_bits_max);
+    return (ms < LEDSTRIP_FRAME_MS) ? LEDSTRIP_FRAME_MS : ms;
+}
+
+
+bool effect_flash(effect_t* e, uint32_t t_ms, effect_pixel_t* layer) {
+    // Flashes left; at most N_LEDSTRIP_FLASH_MAX bits of them
+    if (e->count == 0) {
+        e->count = rand_powof2_range(0, N_LEDSTRIP_FLASH_MAX) + 1;
+        e->next_ms = __flash_ms(N_LEDSTRIP_FLASH_MIN_MS, N_LEDSTRIP_FLASH_MAX_MS);
+    }
+
+    // Catch up with the flashes and delays due since the last frame
+    while (t_ms >= e->next_ms) {
+        if (e->on) {
+            e->count--;
+            if (e->count == 0)
+                return false;
+            e->next_ms += __flash_ms(N_LEDSTRIP_FLASH_DELAY_MIN_MS,
+                                     N_LEDSTRIP_FLASH_DELAY_MAX_MS);
+        } else {
+            e->next_ms += __flash_ms(N_LEDSTRIP_FLASH_MIN_MS,
+                                     N_LEDSTRIP_FLASH_MAX_MS);
+        }
+        e->on = !e->on;
+    }
+
+    if (e->on)
+        __fill(layer, 0, N_LEDSTRIP_LEDS, e->color, EFFECT_OPAQUE);
+    return true;
+}
+// -----------------------------------------------------------------------------
@@ -0,0 +1,98 @@
+/**
+ * @file effects.h
+ * @brief Blade effects and their compositor
+ *
+ * Each effect is a render function drawing one frame of itself, at a time
+ * from its start, into a layer of pixels with alpha. The layers are stacked
+ * in effect_layer_t order and blended bottom up over a dark blade, once per
+ * render tick. An effect ends when its render function says so, and its
+ * layer is then empty; a new one on the same layer replaces it.
+ *
+ * Colors are 16-bit perceptual, see gamma.h, with a 16-bit alpha in layers.
+ */
+
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "ledstrip.h"
+
+
+#define EFFECT_OPAQUE               0xffff
+
+typedef struct {
+    led_color_t c;
+    uint16_t a;                         // 0 transparent to EFFECT_OPAQUE
+} effect_pixel_t;
+
+
+// Bottom to top
+typedef enum {
+    EFFECT_LAYER_BLADE,                 // Ignition, steady blade, retraction
+    EFFECT_LAYER_FLICKER,
+    EFFECT_LAYER_AUDIO,
+    EFFECT_LAYER_BLAST,
+    EFFECT_LAYER_LOCKUP,
+    EFFECT_LAYER_FLASH,
+    EFFECT_N_LAYERS
+} effect_layer_t;
+
+
+typedef struct effect effect_t;
+
+// Draw the effect t_ms after its start into the layer, cleared to
+// transparent. Returns false once over, to be taken off its layer.
+typedef bool (*effect_render_t)(effect_t* e, uint32_t t_ms,
+                                effect_pixel_t* layer);
+
+struct effect {
+    effect_render_t render;             // NULL while the layer is empty
+    uint32_t start_ms;
+    led_color_t color;
+    // Free for the render function, zero on start
+    uint32_t pos;
+    uint32_t count;
+    uint32_t next_ms;
+    bool on;
+};
+
+
+void effects_reset();
+
+// Start an effect at now_ms on a layer, in place of the one there
+effect_t* effects_start(effect_layer_t layer, effect_render_t render,
+                        led_color_t color, uint32_t now_ms);
+void effects_stop(effect_layer_t layer);
+void effects_set_color(effect_layer_t layer, led_color_t color);
+bool effects_running(effect_layer_t layer, effect_render_t render);
+bool effects_active();
+bool effects_active_above(effect_layer_t layer);
+
+// Blend every layer at now_ms into a line of colors. Returns the number of
+// LEDs lit.
+uint32_t effects_render(uint32_t now_ms, led_color_t* line);
+
+
+// ---- Effects ----
+// Light the blade from the hilt over LEDSTRIP_TURN_ON_MS, then hold it
+bool effect_ignition(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+// Put it out from the tip over LEDSTRIP_TURN_OFF_MS
+bool effect_retraction(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+// Dim the blade by a random amount each frame, up to LEDSTRIP_FLICKER_DEPTH
+bool effect_flicker(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+// Dim the blade as the speaker output gets quieter, see LEDSTRIP_AUDIO_DEPTH
+bool effect_audio(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+// A spot at a random place that fades out over LEDSTRIP_BLAST_MS
+bool effect_blast(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+// The whole blade flaring at random, until stopped
+bool effect_lockup(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+// A few random flashes of the whole blade, as on a clash
+bool effect_flash(effect_t* e, uint32_t t_ms, effect_pixel_t* layer);
+
+
+#endif /* EFFECTS_H */
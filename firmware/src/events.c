@@ -0,0 +1,90 @@
+/**
+ * @file events.c
+ * @brief Event queue from the interrupts to the main loop
+ */
+
+
+#include "hal.h"
+#include "config.h"
+#include "events.h"
+#include "cores.h"
+
+
+#if (EVENT_QUEUE_LEN & (EVENT_QUEUE_LEN - 1)) != 0
+    #error "EVENT_QUEUE_LEN must be a power of 2"
+#endif
+
+
+// head is only written by the producer, tail only by the consumer. Both run
+// freely and are masked on use, so the queue holds EVENT_QUEUE_LEN events.
+static event_t queue[EVENT_QUEUE_LEN];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+
+
+void events_init() {
+    head = 0;
+    tail = 0;
+    dropped = 0;
+}
+
+
+bool events_post(event_type_t type, uint8_t arg) {
+    // Only core 0 queues, core 1 hands its events over
+    if (cores_post_event(type, arg))
+        return true;
+
+    uint32_t h = head;
+    if (h - tail >= EVENT_QUEUE_LEN) {
+        dropped++;
+        return false;
+    }
+
+    event_t* ev = &queue[h & (EVENT_QUEUE_LEN - 1)];
+    ev->type = type;
+    ev->arg = arg;
+    // The event must be in the queue before the consumer can see it
+    __sync_synchronize();
+    head = h + 1;
+    return true;
+}
+
+
+bool events_pop(event_t* ev) {
+    uint32_t t = tail;
+    if (t == head)
+        return false;
+
+    __sync_synchronize();
+    *ev = queue[t & (EVENT_QUEUE_LEN - 1)];
+    __sync_synchronize();
+    tail = t + 1;
+    return true;
+}
+
+
+event_t events_wait() {
+    event_t ev;
+
+    while (!events_pop(&ev)) {
+        // Check again with interrupts masked so that an event posted just
+        // now isn't slept through. A pending interrupt still ends the WFI,
+        // and runs once unmasked.
+        uint32_t status = hal_irq_disable();
+        if (head == tail)
+            hal_wait_for_interrupt();
+        hal_irq_restore(status);
+    }
+    return ev;
+}
+
+
+void events_clear() {
+    tail = head;
+}
+
+
+uint32_t events_dropped() {
+    return dropped;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file events.h
+ * @brief Event queue from the interrupts to the main loop
+ *
+ * Interrupt handlers post typed events; the main loop takes them out in
+ * order, sleeping in between. The queue is single producer, single consumer:
+ * every core 0 interrupt that posts, SysTick included (hal_tick_init() sets
+ * its priority), runs at PICO_DEFAULT_IRQ_PRIORITY, so none preempts another
+ * mid-post, and only the main loop takes events out. Neither side needs to
+ * lock. Events posted on core 1 are passed to core 0 first, see cores.h.
+ */
+
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+typedef enum {
+    EVENT_NONE,
+    EVENT_CLASH,                // arg: INT_STATUS of the IMU
+    EVENT_SWING,                // arg: MOT_DETECT_STATUS of the IMU
+    EVENT_BTN_SHORT,
+    EVENT_BTN_LONG,
+    EVENT_BTN_EXTRA_LONG,
+    EVENT_SPK_DONE,             // Every sound has ended and the audio stopped
+    EVENT_IMU_DATA,             // New samples from the IMU FIFO, single core
+    EVENT_CLOCKS,               // Time to check the clock level, see clocks.h
+} event_type_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t arg;
+} event_t;
+
+
+void events_init();
+
+// Post from an interrupt. Returns false, and the event is dropped, if the
+// queue is full.
+bool events_post(event_type_t type, uint8_t arg);
+
+bool events_pop(event_t* ev);           // Take the next event, if any
+event_t events_wait();                  // Sleep until there is an event
+void events_clear();                    // Drop every event queued
+
+uint32_t events_dropped();
+
+
+#endif /* EVENTS_H */
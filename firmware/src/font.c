@@ -0,0 +1,250 @@
+/**
+ * @file font.c
+ * @brief Sound fonts
+ */
+
+
+#include <string.h>
+#include <stddef.h>
+
+#include "hal.h"
+#include "config.h"
+#include "font.h"
+#include "adpcm.h"
+
+
+// Optionally compile in one set of tunes as a fallback for when no font image
+// has been flashed
+#ifdef TUNES_USE_EP4
+    #include "tunes_ep4_44k1.h"
+    #define TUNES_BUILTIN
+#elif defined(TUNES_USE_OBS)
+    #include "tunes_obs_44k1.h"
+    #define TUNES_BUILTIN
+#elif defined(TUNES_USE_CLASSIC)
+    #include "tunes_classic_44k1.h"
+    #define TUNES_BUILTIN
+#elif defined(TUNES_USE_OBS_CLASSICPWR)
+    #include "tunes_obs_classicpower_44k1.h"
+    #define TUNES_BUILTIN
+#endif
+
+// Tune headers generated without --adpcm hold 8-bit PCM
+#if defined(TUNES_BUILTIN) && !defined(TUNES_FORMAT)
+    #define TUNES_FORMAT SOUND_FMT_PCM8
+#endif
+
+// Tune headers from before envelope tracks have none
+#if defined(TUNES_BUILTIN) && defined(TUNES_ENV_SHIFT)
+    #define TUNE_SOUND(data, len, env) \
+        ((sound_t) {data, len, TUNES_FORMAT, TUNES_ENV_SHIFT, env})
+#elif defined(TUNES_BUILTIN)
+    #define TUNE_SOUND(data, len, env) ((sound_t) {data, len, TUNES_FORMAT, 0, NULL})
+#endif
+
+
+// Every font found, and the one currently played. Switching fonts is only a
+// pointer change.
+static font_t fonts[FONT_MAX_FONTS];
+static uint8_t n_fonts = 0;
+static const font_t* volatile font_current = NULL;
+static uint8_t font_idx = 0;
+
+
+// Number of bytes a sound takes in flash
+static uint32_t __sound_size(uint8_t format, uint32_t len) {
+    if (format == SOUND_FMT_ADPCM) {
+        uint32_t n_blocks = (len + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+        return n_blocks * ADPCM_BLOCK_BYTES;
+    }
+    if (format == SOUND_FMT_PCM16)
+        return 2 * len;
+    return len;
+}
+
+
+// Whether a span of the image lies within it
+static inline bool __in_image(const font_header_t* hdr, uint32_t offset,
+                              uint32_t size) {
+    return (offset <= hdr->size) && (size <= hdr->size - offset);
+}
+
+
+// Check a font entry and point a sound at its data and envelope track.
+// Version 1 entries stop short of the track.
+static bool __load_sound(sound_t* snd, const uint8_t* image,
+                         const font_header_t* hdr, const uint8_t* raw) {
+    font_entry_t entry = {0};
+    if (hdr->version == FONT_VERSION_NO_ENV)
+        memcpy(&entry, raw, offsetof(font_entry_t, env_offset));
+    else
+        memcpy(&entry, raw, sizeof(entry));
+
+    if (!__in_image(hdr, entry.offset, __sound_size(hdr->format, entry.len)))
+        return false;
+
+    snd->data = image + entry.offset;
+    snd->len = entry.len;
+    snd->format = hdr->format;
+    snd->env_shift = hdr->env_shift;
+    snd->env = NULL;
+
+    if (entry.env_offset != 0) {
+        uint32_t env_len = (entry.len + (1u << hdr->env_shift) - 1) >> hdr->env_shift;
+        if (!__in_image(hdr, entry.env_offset, env_len))
+            return false;
+        snd->env = image + entry.env_offset;
+    }
+    return true;
+}
+
+
+// Parse a font image in flash. Returns false if it is missing or malformed.
+static bool __load_image(font_t* f, const uint8_t* image, uint32_t max_size) {
+    font_header_t hdr;
+    memcpy(&hdr, image, sizeof(hdr));
+
+    if (hdr.magic != FONT_MAGIC)
+        return false;
+    if (hdr.version == FONT_VERSION_NO_ENV)
+        hdr.env_shift = 0;
+    else if ((hdr.version != FONT_VERSION) || (hdr.env_shift > 16))
+        return false;
+    if ((hdr.format != SOUND_FMT_PCM8) && (hdr.format != SOUND_FMT_ADPCM)
+        && (hdr.format != SOUND_FMT_PCM16))
+        return false;
+    if (hdr.sample_rate != SPK_SAMPLE_RATE)
+        return false;
+    if ((hdr.n_swing > FONT_MAX_SOUNDS) || (hdr.n_clash > FONT_MAX_SOUNDS))
+        return false;
+    if (hdr.size > max_size)
+        return false;
+
+    uint32_t entry_size = (hdr.version == FONT_VERSION_NO_ENV)
+                          ? offsetof(font_entry_t, env_offset) : sizeof(font_entry_t);
+    const uint8_t* entry = image + sizeof(hdr);
+    uint32_t n_entries = FONT_N_FIXED_SOUNDS + hdr.n_swing + hdr.n_clash;
+    if (sizeof(hdr) + n_entries * entry_size > hdr.size)
+        return false;
+
+    bool ok = true;
+    ok &= __load_sound(&f->poweron, image, &hdr, entry);
+    ok &= __load_sound(&f->poweroff, image, &hdr, entry + entry_size);
+    ok &= __load_sound(&f->hum, image, &hdr, entry + 2 * entry_size);
+    entry += FONT_N_FIXED_SOUNDS * entry_size;
+
+    for (uint8_t i = 0; i < hdr.n_swing; i++) {
+        ok &= __load_sound(&f->swing[i], image, &hdr, entry);
+        entry += entry_size;
+    }
+    for (uint8_t i = 0; i < hdr.n_clash; i++) {
+        ok &= __load_sound(&f->clash[i], image, &hdr, entry);
+        entry += entry_size;
+    }
+    if (!ok)
+        return false;
+
+    f->n_swing = hdr.n_swing;
+    f->n_clash = hdr.n_clash;
+    memcpy(f->name, hdr.name, FONT_NAME_LEN);
+    f->name[FONT_NAME_LEN] = '\0';
+    return true;
+}
+
+
+#ifdef TUNES_BUILTIN
+static void __load_builtin(font_t* f) {
+    strcpy(f->name, "builtin");
+
+    f->poweron = TUNE_SOUND(TUNE_POWERON_DATA, TUNE_POWERON_LEN, TUNE_POWERON_ENV);
+    f->poweroff = TUNE_SOUND(TUNE_POWEROFF_DATA, TUNE_POWEROFF_LEN, TUNE_POWEROFF_ENV);
+    f->hum = TUNE_SOUND(TUNE_HUM_DATA, TUNE_HUM_LEN, TUNE_HUM_ENV);
+
+    f->n_swing = (TUNES_SWING_COUNT < FONT_MAX_SOUNDS) ? TUNES_SWING_COUNT : FONT_MAX_SOUNDS;
+    for (uint8_t i = 0; i < f->n_swing; i++) {
+        f->swing[i] = TUNE_SOUND(TUNES_SWING_DATA[i], TUNES_SWING_LENS[i],
+                                 TUNES_SWING_ENVS[i]);
+    }
+    f->n_clash = (TUNES_CLASH_COUNT < FONT_MAX_SOUNDS) ? TUNES_CLASH_COUNT : FONT_MAX_SOUNDS;
+    for (uint8_t i = 0; i < f->n_clash; i++) {
+        f->clash[i] = TUNE_SOUND(TUNES_CLASH_DATA[i], TUNES_CLASH_LENS[i],
+                                 TUNES_CLASH_ENVS[i]);
+    }
+}
+#endif
+
+
+// Load every font of a font table in the partition. A partition holding a
+// single font image is treated as a table of one.
+static void __load_partition(const uint8_t* part) {
+    font_table_t table;
+    memcpy(&table, part, sizeof(table));
+
+    if (table.magic == FONT_MAGIC) {
+        if (__load_image(&fonts[n_fonts], part, FONT_FLASH_SIZE))
+            n_fonts++;
+        return;
+    }
+
+    if ((table.magic != FONT_TABLE_MAGIC) || (table.version != FONT_TABLE_VERSION))
+        return;
+
+    for (uint8_t i = 0; (i < table.n_fonts) && (i < FONT_MAX_FONTS); i++) {
+        uint32_t offset = table.offsets[i];
+        if ((offset < sizeof(table)) || (offset >= FONT_FLASH_SIZE))
+            continue;
+        if (__load_image(&fonts[n_fonts], part + offset, FONT_FLASH_SIZE - offset))
+            n_fonts++;
+    }
+}
+
+
+// Locate the font images in flash, then add the built-in tunes
+bool font_init() {
+    const uint8_t* part = hal_font_partition();
+
+    n_fonts = 0;
+
+    if (part != NULL)
+        __load_partition(part);
+
+    #ifdef TUNES_BUILTIN
+        if (n_fonts < FONT_MAX_FONTS) {
+            __load_builtin(&fonts[n_fonts]);
+            n_fonts++;
+        }
+    #endif
+
+    font_idx = 0;
+    font_current = (n_fonts > 0) ? &fonts[0] : NULL;
+    return (n_fonts > 0);
+}
+
+
+// The current font, or NULL if there is none
+const font_t* font_get() {
+    return font_current;
+}
+
+uint8_t font_count() {
+    return n_fonts;
+}
+
+uint8_t font_get_index() {
+    return font_idx;
+}
+
+
+// Switch to another font. Sounds already playing finish from the old one.
+void font_select(uint8_t idx) {
+    if (idx >= n_fonts)
+        return;
+    font_idx = idx;
+    font_current = &fonts[idx];
+}
+
+void font_next() {
+    if (n_fonts == 0)
+        return;
+    font_select((font_idx + 1) % n_fonts);
+}
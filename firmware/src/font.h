@@ -0,0 +1,103 @@
+/**
+ * @file font.h
+ * @brief Sound fonts
+ *
+ * A sound font is the set of poweron, poweroff, hum, swing and clash sounds
+ * the saber plays. Fonts are normally read from a binary image flashed on its
+ * own at FONT_FLASH_OFFSET, built by `wav2pwm.py --font`. The image is
+ *
+ *      font_header_t
+ *      font_entry_t    poweron, poweroff, hum, swing[n_swing], clash[n_clash]
+ *      sample data and envelope tracks
+ *
+ * all little endian, with entry offsets relative to the start of the image.
+ * Sounds are played straight out of flash.
+ *
+ * Since version 2, each sound may come with an envelope track: one byte per
+ * 2^env_shift samples, the RMS of those samples as the mixer sees them at
+ * unity gain, shifted down by SOUND_ENV_LEVEL_SHIFT. The LEDs can then follow
+ * the sound by looking up its playback position, see SPK_ENV_FROM_TRACKS.
+ * Version 1 images, with shorter entries and no tracks, still load.
+ *
+ * The partition may hold several fonts. It then starts with a font_table_t
+ * listing the offset of each font image from the start of the partition, and
+ * the font played can be switched at runtime.
+ */
+
+
+#ifndef FONT_H
+#define FONT_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mixer.h"
+
+
+#define FONT_MAGIC              0x544e464d      // "MFNT"
+#define FONT_VERSION            2
+#define FONT_VERSION_NO_ENV     1               // Oldest still loaded
+#define FONT_TABLE_MAGIC        0x4254464d      // "MFTB"
+#define FONT_TABLE_VERSION      1
+
+#define FONT_MAX_FONTS          8
+
+#define FONT_N_FIXED_SOUNDS     3               // poweron, poweroff, hum
+#define FONT_MAX_SOUNDS         16              // Per swing / clash list
+#define FONT_NAME_LEN           16
+
+
+typedef struct {
+    uint32_t offset;                    // From the start of the image
+    uint32_t len;                       // In samples
+    uint32_t env_offset;                // Envelope track, 0 for none. Not in
+                                        // version 1 entries.
+} font_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t format;                     // SOUND_FMT_* of every sound
+    uint8_t n_swing;
+    uint8_t n_clash;
+    uint8_t env_shift;                  // Samples per envelope level, log2
+    uint8_t reserved[2];
+    uint32_t sample_rate;
+    uint32_t size;                      // Whole image, in bytes
+    char name[FONT_NAME_LEN];           // Not necessarily null terminated
+} font_header_t;
+
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t n_fonts;
+    uint8_t reserved;
+    uint32_t offsets[FONT_MAX_FONTS];   // From the start of the partition
+} font_table_t;
+
+
+// A font ready to be played
+typedef struct {
+    char name[FONT_NAME_LEN + 1];
+    sound_t poweron;
+    sound_t poweroff;
+    sound_t hum;
+    uint8_t n_swing;
+    uint8_t n_clash;
+    sound_t swing[FONT_MAX_SOUNDS];
+    sound_t clash[FONT_MAX_SOUNDS];
+} font_t;
+
+
+bool font_init();
+const font_t* font_get();
+
+uint8_t font_count();
+uint8_t font_get_index();
+void font_select(uint8_t idx);
+void font_next();
+
+
+#endif /* FONT_H */
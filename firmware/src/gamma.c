@@ -0,0 +1,68 @@
+/**
+ * @file gamma.c
+ * @brief Gamma correction and temporal dithering of LED colors
+ */
+
+
+#include <math.h>
+
+#include "config.h"
+#include "gamma.h"
+
+
+// Duty at 256 points of the curve, interpolated in between
+#define GAMMA_LUT_BITS      8
+#define GAMMA_LUT_LEN       ((1 << GAMMA_LUT_BITS) + 1)
+
+
+static uint16_t __lut[GAMMA_LUT_LEN];
+static uint8_t __err[N_LEDSTRIP_LEDS][3];
+
+
+void gamma_init() {
+    float full = 65535.0f * LEDSTRIP_BRIGHTNESS / 255;
+    for (uint32_t i = 0; i < GAMMA_LUT_LEN; i++) {
+        float x = (float) i / (GAMMA_LUT_LEN - 1);
+        __lut[i] = (uint16_t) (full * powf(x, LEDSTRIP_GAMMA) + 0.5f);
+    }
+
+    for (uint32_t i = 0; i < N_LEDSTRIP_LEDS; i++) {
+        __err[i][0] = __err[i][1] = __err[i][2] = 0;
+    }
+}
+
+
+static inline uint16_t __correct(uint16_t v) {
+    uint32_t idx = v >> (16 - GAMMA_LUT_BITS);
+    uint32_t frac = v & ((1 << (16 - GAMMA_LUT_BITS)) - 1);
+    return __lut[idx]
+        + (((uint32_t) (__lut[idx + 1] - __lut[idx]) * frac) >> (16 - GAMMA_LUT_BITS));
+}
+
+
+void gamma_correct(const led_color_t* line, led_color_t* duty, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        duty[i].g = __correct(line[i].g);
+        duty[i].r = __correct(line[i].r);
+        duty[i].b = __correct(line[i].b);
+    }
+}
+
+
+static inline uint32_t __dither(uint16_t duty, uint8_t* err) {
+    uint32_t v = (uint32_t) duty + *err;
+    *err = v & 0xff;
+    return (v > 0xffff) ? 0xff : v >> 8;
+}
+
+
+void gamma_dither(const led_color_t* duty, uint32_t* grb, uint32_t n) {
+    if (n > N_LEDSTRIP_LEDS)
+        n = N_LEDSTRIP_LEDS;
+
+    for (uint32_t i = 0; i < n; i++) {
+        grb[i] = (__dither(duty[i].g, &__err[i][0]) << 16)
+               | (__dither(duty[i].r, &__err[i][1]) << 8)
+               | __dither(duty[i].b, &__err[i][2]);
+    }
+}
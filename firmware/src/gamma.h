@@ -0,0 +1,34 @@
+/**
+ * @file gamma.h
+ * @brief Gamma correction and temporal dithering of LED colors
+ *
+ * Colors in the LED pipeline are 16 bits per channel and perceptual: equal
+ * steps look equally bright. On the way to the strip each channel goes
+ * through a gamma curve, to LED duty, scaled to LEDSTRIP_BRIGHTNESS at full
+ * scale, then, once the power governor has had its say, down to 8 bits by
+ * temporal dithering: every pixel carries its
+ * rounding error over to the next frame, so a level between two 8-bit steps
+ * shows as their average. Low levels and slow fades then keep their
+ * resolution, at the same current.
+ */
+
+
+#ifndef GAMMA_H
+#define GAMMA_H
+
+
+#include <stdint.h>
+
+#include "ledstrip.h"
+
+
+// Fill the gamma table, in RAM, and clear the dithering errors
+void gamma_init();
+
+// Colors to 16-bit LED duty, per channel
+void gamma_correct(const led_color_t* line, led_color_t* duty, uint32_t n);
+// Duty down to the 8-bit GRB pixels of the next frame
+void gamma_dither(const led_color_t* duty, uint32_t* grb, uint32_t n);
+
+
+#endif /* GAMMA_H */
@@ -0,0 +1,142 @@
+/**
+ * @file hal.h
+ * @brief Hardware abstraction layer
+ *
+ * Everything the drivers need from the RP2040 goes through these functions.
+ * `hal_pico.c` implements them with the Pico SDK; the host build under
+ * `firmware/host/` implements them with fake peripherals, so that the
+ * drivers and their state machines can be built and run on a PC.
+ */
+
+
+#ifndef HAL_H
+#define HAL_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// ------------------------------ SYSTEM ---------------------------------------
+void hal_sys_init();                    // Set up clocks
+void hal_go_dormant();                  // Sleep until the wakeup pin rises
+
+uint32_t hal_irq_disable();
+void hal_irq_restore(uint32_t status);
+
+void hal_sleep_ms(uint32_t ms);
+void hal_idle();                        // Body of a busy-wait loop
+void hal_wait_for_interrupt();          // Sleep until an interrupt is pending
+
+uint32_t hal_rand_bit();                // One random bit from the ROSC
+
+uint32_t hal_time_us();                 // Free-running microsecond timer
+void hal_console_init();                // Route printf() to the UART
+
+// Start the 1 ms tick, which calls isr_tick()
+void hal_tick_init(uint32_t clk_khz);
+
+// Switch the system clock to a level of SYS_CLK_LEVEL_PLANS, and the speaker
+// PWM, LED strip PIO and I2C dividers with it, once the LED strip and the IMU
+// bus are idle. From core 0. Returns the clock in kHz, for the tick.
+uint32_t hal_sys_set_clock(uint8_t level);
+// -----------------------------------------------------------------------------
+
+// ------------------------------ MULTICORE ------------------------------------
+// Words between the cores go through the SIO inter-core FIFOs, 8 deep each
+// way. Each core takes the words sent to it in an interrupt.
+typedef void (*hal_core_msg_handler_t)(uint32_t msg);
+
+// Start core 1 on init, then have it sleep and take interrupts, including
+// the words from core 0 to core1_handler. Words from core 1 go to
+// core0_handler.
+void hal_core1_launch(void (*init)(), hal_core_msg_handler_t core1_handler,
+                      hal_core_msg_handler_t core0_handler);
+// Send a word to the other core. Returns false if its FIFO is full.
+bool hal_core_send(uint32_t msg);
+uint8_t hal_core_num();
+
+// Mask interrupts and take a hardware spinlock, for state shared by both
+// cores
+uint32_t hal_lock_cores();
+void hal_unlock_cores(uint32_t status);
+// -----------------------------------------------------------------------------
+
+// ------------------------------ GPIO -----------------------------------------
+typedef void (*hal_gpio_irq_callback_t)();
+
+void hal_gpio_init(uint8_t pin, bool out);
+void hal_gpio_put(uint8_t pin, bool value);
+bool hal_gpio_get(uint8_t pin);
+
+// Call back on every falling edge of an input pin
+void hal_gpio_irq_falling(uint8_t pin, hal_gpio_irq_callback_t callback);
+// -----------------------------------------------------------------------------
+
+// ------------------------------ I2C ------------------------------------------
+// Called from the I2C interrupt when an asynchronous transfer is over
+typedef void (*hal_i2c_callback_t)(bool ok);
+
+void hal_i2c_init(uint32_t baud);
+
+// Blocking, from the main loop only. Wait for any transfer in flight first.
+// Return the number of bytes transferred, or a negative value on error.
+int hal_i2c_write(uint8_t addr, const uint8_t* src, size_t len);
+// Write, then read after a repeated start, as one transfer
+int hal_i2c_write_read(uint8_t addr, const uint8_t* src, size_t src_len,
+                       uint8_t* dst, size_t dst_len);
+
+// The same write-then-read, driven by the I2C interrupt, which calls back
+// once done. dst_len may be 0. The buffers must stay valid until then.
+// Returns false without starting if the bus is in use.
+bool hal_i2c_transfer_async(uint8_t addr, const uint8_t* src, size_t src_len,
+                            uint8_t* dst, size_t dst_len,
+                            hal_i2c_callback_t callback);
+// -----------------------------------------------------------------------------
+
+// ------------------------------ AUDIO ----------------------------------------
+// Called from the audio interrupt once half `half` of the ping-pong buffer has
+// been played out and may be refilled. The other half is playing meanwhile.
+typedef void (*hal_audio_callback_t)(uint8_t half);
+
+// Set up the speaker PWM and the DMA that streams buffers of len PWM compare
+// values to it, one per PWM wrap
+void hal_audio_init(uint16_t* buf0, uint16_t* buf1, uint32_t len,
+                    hal_audio_callback_t callback);
+void hal_audio_start();                 // Play from the first half on
+void hal_audio_stop();
+// -----------------------------------------------------------------------------
+
+// ------------------------------ LED STRIP ------------------------------------
+// Frames are sent by DMA straight from the caller's buffer, as the PIO
+// program takes them. With one strand, a word per LED: GRB in the upper 24
+// bits. With strands in parallel, bit planes, see strands.h.
+#define HAL_LED_WORD(grb)       ((uint32_t) (grb) << 8)
+
+// Called from an interrupt once a frame is out and the strip has latched it,
+// so the next one may be sent
+typedef void (*hal_led_callback_t)();
+
+void hal_led_init(hal_led_callback_t done);
+// Start sending a frame of n words. The buffer must stay untouched until the
+// callback. Returns false without starting if a frame is still being sent.
+bool hal_led_show(const uint32_t* frame, uint32_t n);
+bool hal_led_busy();
+
+// Render tick, at a fixed rate apart from the 1 ms tick: the callback is
+// called from an interrupt every period_us until it returns false or the
+// timer is stopped. Starting it again while it runs does nothing.
+typedef bool (*hal_led_timer_callback_t)();
+
+void hal_led_timer_start(uint32_t period_us, hal_led_timer_callback_t callback);
+void hal_led_timer_stop();
+// -----------------------------------------------------------------------------
+
+// ------------------------------ FLASH ----------------------------------------
+// The sound font partition, or NULL if there is none
+const uint8_t* hal_font_partition();
+// -----------------------------------------------------------------------------
+
+
+#endif /* HAL_H */
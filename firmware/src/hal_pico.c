@@ -0,0 +1,721 @@
+/**
+ * @file hal_pico.c
+ * @brief Hardware abstraction layer, Pico SDK implementation
+ */
+
+
+#include "pico/stdlib.h"
+#include "pico/sleep.h"
+#include "pico/multicore.h"
+#include "hardware/clocks.h"
+#include "hardware/pll.h"
+#include "hardware/xosc.h"
+#include "hardware/rosc.h"
+#include "hardware/sync.h"
+#include "hardware/structs/sio.h"
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/exception.h"
+#include "hardware/pio.h"
+#include "hardware/regs/clocks.h"
+#include "hardware/structs/syscfg.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "ws2812.pio.h"
+
+#include "config.h"
+#include "pinmap.h"
+#include "hal.h"
+
+
+#define PIN_SYS_WAKEUP  PIN_BTN
+
+#define I2C_IMU_INST    i2c0
+
+#define LED_PIO         pio0
+#define LED_SM          0
+
+
+// ------------------------------ SYSTEM ---------------------------------------
+// The PLL settings of the clock plan rather than set_sys_clock_khz(), which
+// would pick the highest VCO
+static void __set_sys_clock() {
+    set_sys_clock_pll(SYS_PLL_VCO_KHZ * KHZ, SYS_PLL_POSTDIV1, SYS_PLL_POSTDIV2);
+}
+
+
+void hal_sys_init() {
+    // To save more power, use ROSC instead of XOSC
+
+    // Should really rewrite the initialization code, but ah well
+    __set_sys_clock();
+
+    // Turn off unused peripheral clocks
+    clock_stop(clk_usb);
+    clock_stop(clk_adc);
+    clock_stop(clk_rtc);
+    // The UART runs off clk_peri, keep it for dumping traces
+    #ifndef TRACE_ENABLE
+        clock_stop(clk_peri);
+    #endif
+
+    // Turn off ROSC
+    //rosc_disable();
+}
+
+
+void hal_go_dormant() {
+    //sleep_run_from_rosc();
+
+    // Reimplement sleep_run_from_rosc() so that RTC clock isn't started
+    clock_configure(clk_ref,
+                    CLOCKS_CLK_REF_CTRL_SRC_VALUE_ROSC_CLKSRC_PH,
+                    0, // No aux mux
+                    6.5 * MHZ,
+                    6.5 * MHZ);
+
+    // CLK SYS = CLK_REF
+    clock_configure(clk_sys,
+                    CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF,
+                    0, // Using glitchless mux
+                    6.5 * MHZ,
+                    6.5 * MHZ);
+
+    pll_deinit(pll_sys);
+    pll_deinit(pll_usb);
+    xosc_disable();
+
+    // Dormant until rising edge on PIN_SYS_WAKEUP (button press/release)
+    gpio_set_dormant_irq_enabled(PIN_SYS_WAKEUP,
+                                 IO_BANK0_DORMANT_WAKE_INTE0_GPIO0_EDGE_HIGH_BITS,
+                                 true);
+
+    // Power down the SRAM banks. Can power down at leat the USB
+    //syscfg_hw->mempowerdown = 0x40;
+    //rosc_set_dormant();
+    //syscfg_hw->mempowerdown = 0x00;
+
+    // TODO: this might actually be working; measure the current draw vs above.
+    // Disabling XIP cache seems to have no power savings
+    //xip_ctrl_hw->ctrl = 0x0000000c;     // Power down XIP cache
+    rosc_write(&rosc_hw->dormant, ROSC_DORMANT_VALUE_DORMANT);
+    syscfg_hw->mempowerdown = 0x7f;
+    while(!(rosc_hw->status & ROSC_STATUS_STABLE_BITS));
+    syscfg_hw->mempowerdown = 0x00;
+    //xip_ctrl_hw->ctrl = 0x00000003;     // Power up XIP cache
+
+    // After wakeup, set up clocks
+    rosc_write(&rosc_hw->ctrl, ROSC_CTRL_ENABLE_BITS);
+    clocks_init();
+    __set_sys_clock();
+}
+
+
+inline uint32_t hal_irq_disable() {
+    return save_and_disable_interrupts();
+}
+
+inline void hal_irq_restore(uint32_t status) {
+    restore_interrupts(status);
+}
+
+
+void hal_sleep_ms(uint32_t ms) {
+    sleep_ms(ms);
+}
+
+inline void hal_idle() {
+    tight_loop_contents();
+}
+
+inline void hal_wait_for_interrupt() {
+    __wfi();
+}
+
+
+inline uint32_t hal_rand_bit() {
+    return (0x0001 & rosc_hw->randombit);
+}
+
+
+inline uint32_t hal_time_us() {
+    return time_us_32();
+}
+
+void hal_console_init() {
+    stdio_init_all();
+}
+
+
+void hal_tick_init(uint32_t clk_khz) {
+    systick_hw->csr = 0; 	    // Disable SysTick
+    // SysTick resets to the highest priority; at the IRQ default, it can't
+    // preempt the other event producers, see events.h
+    exception_set_priority(SYSTICK_EXCEPTION, PICO_DEFAULT_IRQ_PRIORITY);
+    // Set the reload value to 1ms
+	systick_hw->rvr = (uint32_t) (clk_khz - 1);
+	systick_hw->cvr = 0;        // Clear count to force reload
+    systick_hw->csr = 0x7;      // Enable, use system clock, enable interrupt
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ MULTICORE ------------------------------------
+static void (*core1_init)();
+static hal_core_msg_handler_t core_handlers[2];
+static spin_lock_t* cores_lock;
+
+
+// SIO_IRQ_PROC0 on core 0, SIO_IRQ_PROC1 on core 1
+static void __sio_irq_handler() {
+    hal_core_msg_handler_t handler = core_handlers[get_core_num()];
+    while (multicore_fifo_rvalid()) {
+        handler(multicore_fifo_pop_blocking());
+    }
+    multicore_fifo_clear_irq();
+}
+
+
+static void __core1_entry() {
+    core1_init();
+
+    // Only take messages once set up; they wait in the FIFO until then
+    multicore_fifo_clear_irq();
+    irq_set_exclusive_handler(SIO_IRQ_PROC1, __sio_irq_handler);
+    irq_set_enabled(SIO_IRQ_PROC1, true);
+
+    while (true) {
+        __wfi();
+    }
+}
+
+
+void hal_core1_launch(void (*init)(), hal_core_msg_handler_t core1_handler,
+                      hal_core_msg_handler_t core0_handler) {
+    core1_init = init;
+    core_handlers[1] = core1_handler;
+    core_handlers[0] = core0_handler;
+    cores_lock = spin_lock_init(spin_lock_claim_unused(true));
+
+    // The launch handshake goes through the FIFOs, so the interrupt of core
+    // 0 must not be enabled before
+    multicore_launch_core1(__core1_entry);
+
+    multicore_fifo_clear_irq();
+    irq_set_exclusive_handler(SIO_IRQ_PROC0, __sio_irq_handler);
+    irq_set_enabled(SIO_IRQ_PROC0, true);
+}
+
+
+bool hal_core_send(uint32_t msg) {
+    if (!multicore_fifo_wready())
+        return false;
+    multicore_fifo_push_blocking(msg);
+    return true;
+}
+
+inline uint8_t hal_core_num() {
+    return get_core_num();
+}
+
+
+uint32_t hal_lock_cores() {
+    // Single core builds never claim the lock
+    if (cores_lock == NULL)
+        return save_and_disable_interrupts();
+    return spin_lock_blocking(cores_lock);
+}
+
+void hal_unlock_cores(uint32_t status) {
+    if (cores_lock == NULL)
+        restore_interrupts(status);
+    else
+        spin_unlock(cores_lock, status);
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ GPIO -----------------------------------------
+static hal_gpio_irq_callback_t gpio_callbacks[NUM_BANK0_GPIOS];
+
+
+static void __gpio_irq_handler(uint gpio, uint32_t events) {
+    gpio_acknowledge_irq(gpio, events);
+    if (gpio_callbacks[gpio])
+        gpio_callbacks[gpio]();
+}
+
+
+void hal_gpio_init(uint8_t pin, bool out) {
+    gpio_init(pin);
+    gpio_set_dir(pin, out ? GPIO_OUT : GPIO_IN);
+}
+
+inline void hal_gpio_put(uint8_t pin, bool value) {
+    gpio_put(pin, value);
+}
+
+inline bool hal_gpio_get(uint8_t pin) {
+    return gpio_get(pin);
+}
+
+
+void hal_gpio_irq_falling(uint8_t pin, hal_gpio_irq_callback_t callback) {
+    gpio_callbacks[pin] = callback;
+    gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_FALL, true, &__gpio_irq_handler);
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ I2C ------------------------------------------
+// Asynchronous transfers queue commands into the controller's data_cmd FIFO
+// and collect the bytes read from its interrupt, a FIFO's worth at a time.
+// A transfer is a write of src followed by a read into dst after a repeated
+// start, with a stop after the last byte.
+static volatile bool i2c_busy = false;
+static const uint8_t* i2c_src;
+static uint8_t* i2c_dst;
+static size_t i2c_src_len;
+static size_t i2c_n_cmds;               // Bytes written + bytes to read
+static size_t i2c_n_sent;               // Commands queued so far
+static size_t i2c_n_read;
+static hal_i2c_callback_t i2c_callback;
+static uint32_t i2c_baud;               // Rederived on a clock change
+
+
+// Queue as many commands as the TX FIFO takes
+static void __i2c_push_cmds(i2c_hw_t* hw) {
+    while ((i2c_n_sent < i2c_n_cmds) && (i2c_get_write_available(I2C_IMU_INST) > 0)) {
+        uint32_t cmd;
+        if (i2c_n_sent < i2c_src_len) {
+            cmd = i2c_src[i2c_n_sent];
+        } else {
+            cmd = I2C_IC_DATA_CMD_CMD_BITS;
+            if ((i2c_n_sent == i2c_src_len) && (i2c_src_len > 0))
+                cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+        }
+        if (i2c_n_sent == i2c_n_cmds - 1)
+            cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+
+        hw->data_cmd = cmd;
+        i2c_n_sent++;
+    }
+
+    // Nothing more to send, stop asking
+    if (i2c_n_sent == i2c_n_cmds)
+        hw_clear_bits(&hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+}
+
+
+static void __i2c_drain_rx(i2c_hw_t* hw) {
+    while ((hw->rxflr > 0) && (i2c_n_read < i2c_n_cmds - i2c_src_len)) {
+        i2c_dst[i2c_n_read++] = (uint8_t) hw->data_cmd;
+    }
+}
+
+
+static void __i2c_finish(i2c_hw_t* hw, bool ok) {
+    hw->intr_mask = 0;
+    i2c_busy = false;
+    i2c_callback(ok);
+}
+
+
+static void __i2c_irq_handler() {
+    i2c_hw_t* hw = i2c_get_hw(I2C_IMU_INST);
+    uint32_t stat = hw->intr_stat;
+
+    // NACK or lost arbitration. The controller flushes the FIFO and stops.
+    if (stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        (void) hw->clr_tx_abrt;
+        (void) hw->clr_stop_det;
+        __i2c_finish(hw, false);
+        return;
+    }
+
+    __i2c_drain_rx(hw);
+    __i2c_push_cmds(hw);
+
+    if (stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void) hw->clr_stop_det;
+        __i2c_drain_rx(hw);
+        __i2c_finish(hw, i2c_n_read == i2c_n_cmds - i2c_src_len);
+    }
+}
+
+
+// Take the bus for a blocking transfer, waiting out an asynchronous one
+static void __i2c_claim() {
+    while (true) {
+        uint32_t status = save_and_disable_interrupts();
+        if (!i2c_busy) {
+            i2c_busy = true;
+            restore_interrupts(status);
+            return;
+        }
+        restore_interrupts(status);
+        tight_loop_contents();
+    }
+}
+
+
+void hal_i2c_init(uint32_t baud) {
+    i2c_baud = baud;
+    i2c_init(I2C_IMU_INST, baud);
+    gpio_set_function(PIN_IMU_SDA, GPIO_FUNC_I2C);
+    gpio_set_function(PIN_IMU_SCL, GPIO_FUNC_I2C);
+    // Unnecessary, there are external PU
+    //gpio_pull_up(PIN_IMU_SDA);
+    //gpio_pull_up(PIN_IMU_SCL);
+
+    i2c_hw_t* hw = i2c_get_hw(I2C_IMU_INST);
+    hw->intr_mask = 0;
+    hw->rx_tl = 0;                      // Interrupt on every byte received
+    hw->tx_tl = 0;                      // and once the TX FIFO has emptied
+    i2c_busy = false;
+
+    irq_set_exclusive_handler(I2C0_IRQ, __i2c_irq_handler);
+    irq_set_enabled(I2C0_IRQ, true);
+}
+
+
+int hal_i2c_write(uint8_t addr, const uint8_t* src, size_t len) {
+    __i2c_claim();
+    int ret = i2c_write_blocking(I2C_IMU_INST, addr, src, len, false);
+    i2c_busy = false;
+    return ret;
+}
+
+int hal_i2c_write_read(uint8_t addr, const uint8_t* src, size_t src_len,
+                       uint8_t* dst, size_t dst_len) {
+    __i2c_claim();
+    int ret = i2c_write_blocking(I2C_IMU_INST, addr, src, src_len, true);
+    if (ret >= 0)
+        ret = i2c_read_blocking(I2C_IMU_INST, addr, dst, dst_len, false);
+    i2c_busy = false;
+    return ret;
+}
+
+
+bool hal_i2c_transfer_async(uint8_t addr, const uint8_t* src, size_t src_len,
+                            uint8_t* dst, size_t dst_len,
+                            hal_i2c_callback_t callback) {
+    uint32_t status = save_and_disable_interrupts();
+    if (i2c_busy || (src_len + dst_len == 0)) {
+        restore_interrupts(status);
+        return false;
+    }
+    i2c_busy = true;
+    restore_interrupts(status);
+
+    i2c_src = src;
+    i2c_dst = dst;
+    i2c_src_len = src_len;
+    i2c_n_cmds = src_len + dst_len;
+    i2c_n_sent = 0;
+    i2c_n_read = 0;
+    i2c_callback = callback;
+
+    i2c_hw_t* hw = i2c_get_hw(I2C_IMU_INST);
+    hw->enable = 0;
+    hw->tar = addr;
+    hw->enable = 1;
+
+    (void) hw->clr_intr;
+    __i2c_push_cmds(hw);
+    hw->intr_mask = I2C_IC_INTR_MASK_M_TX_ABRT_BITS
+                  | I2C_IC_INTR_MASK_M_STOP_DET_BITS
+                  | I2C_IC_INTR_MASK_M_RX_FULL_BITS
+                  | ((i2c_n_sent < i2c_n_cmds) ? I2C_IC_INTR_MASK_M_TX_EMPTY_BITS : 0);
+    return true;
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ AUDIO ----------------------------------------
+// 2 DMA channels, one per half-buffer, chained to each other. Each writes its
+// half to the PWM compare register one value per PWM wrap, then starts the
+// other and raises an interrupt so its own half can be refilled.
+static int dma_chan[2];
+static uint32_t dma_chan_mask;
+static uint16_t* audio_buf[2];
+static hal_audio_callback_t audio_callback;
+static volatile bool audio_running = false;
+
+
+static void __dma_irq_handler() {
+    // Acknowledge the interrupt(s)
+    uint32_t ints = dma_hw->ints0 & dma_chan_mask;
+    dma_hw->ints0 = ints;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        // Aborted by hal_audio_stop(), possibly from the callback
+        if (!audio_running)
+            return;
+
+        if (ints & (1u << dma_chan[i])) {
+            // The other half is playing now, rewind this one for next time
+            dma_channel_set_read_addr(dma_chan[i], audio_buf[i], false);
+            audio_callback(i);
+        }
+    }
+}
+
+
+void hal_audio_init(uint16_t* buf0, uint16_t* buf1, uint32_t len,
+                    hal_audio_callback_t callback) {
+    audio_buf[0] = buf0;
+    audio_buf[1] = buf1;
+    audio_callback = callback;
+    audio_running = false;
+
+    // Get PWM slice and set up PWM
+    gpio_set_function(PIN_SPK_PWM, GPIO_FUNC_PWM);
+    pwm_set_gpio_level(PIN_SPK_PWM, 0);
+
+    int spk_pwm_slice = pwm_gpio_to_slice_num(PIN_SPK_PWM);
+    pwm_config pwm_cfg = pwm_get_default_config();
+    // Exactly the planned divider, see clock_plan.h
+    pwm_config_set_clkdiv_int_frac(&pwm_cfg, SPK_PWM_CLKDIV_INT, SPK_PWM_CLKDIV_FRAC);
+    pwm_config_set_wrap(&pwm_cfg, SPK_PWM_COUNT_TOP);
+    pwm_init(spk_pwm_slice, &pwm_cfg, true);
+
+    dma_chan[0] = dma_claim_unused_channel(true);
+    dma_chan[1] = dma_claim_unused_channel(true);
+    dma_chan_mask = (1u << dma_chan[0]) | (1u << dma_chan[1]);
+
+    for (uint8_t i = 0; i < 2; i++) {
+        dma_channel_config cfg = dma_channel_get_default_config(dma_chan[i]);
+        // 16-bit writes are replicated on both upper and lower halves of CC
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+        channel_config_set_read_increment(&cfg, true);
+        channel_config_set_write_increment(&cfg, false);
+        // Start the other half when done
+        channel_config_set_chain_to(&cfg, dma_chan[i ^ 1]);
+        // Transfer on PWM cycle end
+        channel_config_set_dreq(&cfg, DREQ_PWM_WRAP0 + spk_pwm_slice);
+
+        dma_channel_configure(
+            dma_chan[i],
+            &cfg,
+            &pwm_hw->slice[spk_pwm_slice].cc,   // Write to PWM slice CC register
+            audio_buf[i],
+            len,                                // One transfer per PWM wrap
+            false                               // Do not start yet
+        );
+
+        // Interrupt when each half is done
+        dma_channel_set_irq0_enabled(dma_chan[i], true);
+    }
+
+    irq_set_exclusive_handler(DMA_IRQ_0, __dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+
+void hal_audio_start() {
+    if (audio_running)
+        return;
+    audio_running = true;
+    dma_channel_set_read_addr(dma_chan[1], audio_buf[1], false);
+    dma_channel_set_read_addr(dma_chan[0], audio_buf[0], true);
+}
+
+
+void hal_audio_stop() {
+    audio_running = false;
+    dma_hw->abort = dma_chan_mask;
+    while (dma_hw->abort & dma_chan_mask) {
+        tight_loop_contents();
+    }
+    dma_hw->ints0 = dma_chan_mask;
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ LED STRIP ------------------------------------
+// One DMA channel feeds the PIO TX FIFO, paced by its DREQ. Its interrupt
+// fires once the last word is in the FIFO; the strip is only done after the
+// FIFO and shift register have drained and the line has been held low for
+// the reset time, which a timer alarm waits out.
+#if LEDSTRIP_N_STRANDS > 1
+    #define LED_BITS_PER_WORD   4       // Bit planes of all strands
+#else
+    #define LED_BITS_PER_WORD   24
+#endif
+#define LED_US_PER_WORD         ((LED_BITS_PER_WORD * 1000000) / LEDSTRIP_BIT_RATE_HZ)
+#define LED_DRAIN_US            ((8 + 1) * LED_US_PER_WORD)
+
+#if LEDSTRIP_N_STRANDS > 1
+    #define LED_CYCLES_PER_BIT  (ws2812_parallel_T1 + ws2812_parallel_T2 + ws2812_parallel_T3)
+#else
+    #define LED_CYCLES_PER_BIT  (ws2812_T1 + ws2812_T2 + ws2812_T3)
+#endif
+
+#define __PIN_IN_STRANDS(pin)   (((pin) >= PIN_LEDSTRIP_STRANDS) && \
+                                 ((pin) < PIN_LEDSTRIP_STRANDS + LEDSTRIP_N_STRANDS))
+#if (LEDSTRIP_N_STRANDS > 1) && (__PIN_IN_STRANDS(PIN_SPK_PWM) \
+        || __PIN_IN_STRANDS(PIN_SPK_EN) || __PIN_IN_STRANDS(PIN_BTN) \
+        || __PIN_IN_STRANDS(PIN_IMU_SDA) || __PIN_IN_STRANDS(PIN_IMU_SCL) \
+        || __PIN_IN_STRANDS(PIN_IMU_INT))
+    #error "LED strand pins overlap other pins, see PIN_LEDSTRIP_STRANDS"
+#endif
+
+static int led_dma_chan;
+static hal_led_callback_t led_done;
+static volatile bool led_busy = false;
+
+
+static int64_t __led_latched(alarm_id_t id, void* user_data) {
+    led_busy = false;
+    if (led_done)
+        led_done();
+    return 0;
+}
+
+
+static void __led_dma_irq_handler() {
+    dma_hw->ints1 = 1u << led_dma_chan;
+    add_alarm_in_us(LED_DRAIN_US + LEDSTRIP_RESET_US, __led_latched, NULL, true);
+}
+
+
+void hal_led_init(hal_led_callback_t done) {
+    led_done = done;
+    led_busy = false;
+
+    #if LEDSTRIP_N_STRANDS > 1
+        uint offset = pio_add_program(LED_PIO, &ws2812_parallel_program);
+        ws2812_parallel_program_init(LED_PIO, LED_SM, offset,
+                                     PIN_LEDSTRIP_STRANDS, LEDSTRIP_N_STRANDS,
+                                     LEDSTRIP_BIT_RATE_HZ);
+    #else
+        uint offset = pio_add_program(LED_PIO, &ws2812_program);
+
+        // Not an RGBW strip
+        ws2812_program_init(LED_PIO, LED_SM, offset, PIN_LEDSTRIP,
+                            LEDSTRIP_BIT_RATE_HZ, false);
+    #endif
+
+    led_dma_chan = dma_claim_unused_channel(true);
+    dma_channel_config cfg = dma_channel_get_default_config(led_dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, pio_get_dreq(LED_PIO, LED_SM, true));
+    dma_channel_configure(led_dma_chan, &cfg, &LED_PIO->txf[LED_SM], NULL, 0,
+                          false);
+
+    // DMA_IRQ_0 is the audio's, possibly on the other core
+    dma_channel_set_irq1_enabled(led_dma_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, __led_dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+
+bool hal_led_show(const uint32_t* frame, uint32_t n) {
+    if (led_busy || (n == 0))
+        return false;
+    led_busy = true;
+    dma_channel_transfer_from_buffer_now(led_dma_chan, frame, n);
+    return true;
+}
+
+inline bool hal_led_busy() {
+    return led_busy;
+}
+
+
+static repeating_timer_t led_timer;
+static hal_led_timer_callback_t led_timer_callback;
+static volatile bool led_timer_running = false;
+
+
+static bool __led_timer_handler(repeating_timer_t* rt) {
+    if (led_timer_callback())
+        return true;
+    led_timer_running = false;
+    return false;
+}
+
+
+void hal_led_timer_start(uint32_t period_us, hal_led_timer_callback_t callback) {
+    if (led_timer_running)
+        return;
+    led_timer_callback = callback;
+    led_timer_running = true;
+    // Negative: the period is from one call to the next, not from the return
+    add_repeating_timer_us(-(int64_t) period_us, __led_timer_handler, NULL,
+                           &led_timer);
+}
+
+void hal_led_timer_stop() {
+    if (led_timer_running) {
+        cancel_repeating_timer(&led_timer);
+        led_timer_running = false;
+    }
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ CLOCK SCALING --------------------------------
+// Everything clocked from clk_sys is set again for the new clock. The switch
+// runs clk_sys from pll_usb while pll_sys locks, so the speaker is off pitch
+// for that long; an LED frame or an I2C transfer would be garbled, so they
+// are waited out, and core 0 interrupts, which start them, held off.
+typedef struct {
+    uint32_t vco_khz;
+    uint8_t postdiv1;
+    uint8_t postdiv2;
+    uint8_t pwm_div_int;
+    uint8_t pwm_div_frac;
+} sys_clock_plan_t;
+
+static const uint32_t sys_clock_khz[] = SYS_CLK_LEVEL_KHZ;
+static const sys_clock_plan_t sys_clock_plans[] = SYS_CLK_LEVEL_PLANS;
+
+
+uint32_t hal_sys_set_clock(uint8_t level) {
+    const sys_clock_plan_t* plan = &sys_clock_plans[level];
+
+    __i2c_claim();
+    uint32_t status;
+    while (true) {
+        status = save_and_disable_interrupts();
+        if (!led_busy)
+            break;
+        restore_interrupts(status);
+        tight_loop_contents();
+    }
+
+    set_sys_clock_pll(plan->vco_khz * KHZ, plan->postdiv1, plan->postdiv2);
+    pwm_set_clkdiv_int_frac(pwm_gpio_to_slice_num(PIN_SPK_PWM),
+                            plan->pwm_div_int, plan->pwm_div_frac);
+    pio_sm_set_clkdiv(LED_PIO, LED_SM, (float) clock_get_hz(clk_sys)
+                      / ((float) LEDSTRIP_BIT_RATE_HZ * LED_CYCLES_PER_BIT));
+    if (i2c_baud)
+        i2c_set_baudrate(I2C_IMU_INST, i2c_baud);
+
+    // set_sys_clock_pll() starts clk_peri again
+    #ifdef TRACE_ENABLE
+        uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+    #else
+        clock_stop(clk_peri);
+    #endif
+
+    restore_interrupts(status);
+    i2c_busy = false;
+    return sys_clock_khz[level];
+}
+// -----------------------------------------------------------------------------
+
+// ------------------------------ FLASH ----------------------------------------
+// End of the firmware image in flash, from the linker script
+extern char __flash_binary_end;
+
+const uint8_t* hal_font_partition() {
+    const uint8_t* part = (const uint8_t*) (XIP_BASE + FONT_FLASH_OFFSET);
+
+    // A firmware image running into the font partition would have
+    // overwritten the start of it
+    if ((uintptr_t) &__flash_binary_end > (uintptr_t) part)
+        return NULL;
+    return part;
+}
+// -----------------------------------------------------------------------------
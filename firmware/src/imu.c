@@ -4,88 +4,234 @@
  */ 
 
 
-#include "pico/stdlib.h"
-#include "hardware/i2c.h"
-#include "hardware/sync.h"
+#include "hal.h"
 #include <stdio.h>
 #include <string.h>
 
 #include "config.h"
 #include "pinmap.h"
 #include "imu.h"
+#include "trace.h"
+#include "events.h"
+#include "cores.h"
+
+
+// Interrupt handling is a chain of asynchronous register reads, each started
+// from the completion of the previous one: INT_STATUS, then MOT_DETECT_STATUS
+// for a zero-motion interrupt, then in FIFO mode FIFO_COUNT and the FIFO
+// contents. Reading INT_STATUS releases the INT pin.
+static const uint8_t REG_INT_STATUS = MPU6050_REG_INT_STATUS;
+static const uint8_t REG_MOT_DETECT_STATUS = MPU6050_REG_MOT_DETECT_STATUS;
+static uint8_t __intmask;
+static uint8_t __motion_status;
+
+// An interrupt came in while the bus was in use
+static volatile bool __int_pending = false;
+
+static void __read_int_status();
+
+
+#ifdef IMU_FIFO_MODE
+
+#if (IMU_SAMPLE_BUFFER_LEN & (IMU_SAMPLE_BUFFER_LEN - 1)) != 0
+    #error "IMU_SAMPLE_BUFFER_LEN must be a power of 2"
+#endif
+
+// Read up to twice a burst at once, to catch up after a delay
+#define IMU_FIFO_MAX_READ       (2 * IMU_FIFO_BURST)
+
+static const uint8_t REG_FIFO_COUNTH = MPU6050_REG_FIFO_COUNTH;
+static const uint8_t REG_FIFO_R_W = MPU6050_REG_FIFO_R_W;
+static const uint8_t FIFO_RESET[] = {MPU6050_REG_USER_CTRL, 0x44};
+static uint8_t __fifo_count[2];
+static uint8_t __fifo_data[IMU_FIFO_MAX_READ * MPU6050_FIFO_SAMPLE_BYTES];
+static uint32_t __fifo_n_read;
+
+// DATA_RDY pulses since the last burst, and whether a burst is waiting to be
+// read
+static volatile uint32_t __n_ready = 0;
+static volatile bool __fifo_due = false;
+
+// Filled from the I2C interrupt, emptied by the main loop
+static imu_sample_t __samples[IMU_SAMPLE_BUFFER_LEN];
+static volatile uint32_t __samples_head = 0;
+static volatile uint32_t __samples_tail = 0;
+static volatile uint32_t __samples_dropped = 0;
+
+static void __chain_done(bool ok);
+
+
+static void __fifo_data_done(bool ok) {
+    if (ok) {
+        const uint8_t* p = __fifo_data;
+        uint32_t h = __samples_head;
+
+        for (uint32_t i = 0; i < __fifo_n_read; i++) {
+            if (h - __samples_tail >= IMU_SAMPLE_BUFFER_LEN) {
+                __samples_dropped += __fifo_n_read - i;
+                break;
+            }
+            imu_sample_t* smp = &__samples[h & (IMU_SAMPLE_BUFFER_LEN - 1)];
+            for (uint8_t k = 0; k < 3; k++) {
+                smp->accel[k] = (int16_t) ((p[2 * k] << 8) | p[2 * k + 1]);
+                smp->gyro[k] = (int16_t) ((p[6 + 2 * k] << 8) | p[6 + 2 * k + 1]);
+            }
+            p += MPU6050_FIFO_SAMPLE_BYTES;
+            h++;
+        }
 
+        __sync_synchronize();
+        __samples_head = h;
+        if (!cores_notify(CORES_MSG_IMU_DATA, 0))
+            events_post(EVENT_IMU_DATA, 0);
+    }
+    __chain_done(true);
+}
 
-#define I2C_IMU_INST i2c0
 
+static void __fifo_count_done(bool ok) {
+    uint32_t count = ((uint32_t) __fifo_count[0] << 8) | __fifo_count[1];
+    uint32_t n = count / MPU6050_FIFO_SAMPLE_BYTES;
+    if (n > IMU_FIFO_MAX_READ)
+        n = IMU_FIFO_MAX_READ;
 
-// Flags for application code to handle at leisure
-volatile bool __has_clash = false;
-volatile bool __has_swing = false;
+    if (!ok || (n == 0)) {
+        __chain_done(true);
+        return;
+    }
 
+    __fifo_n_read = n;
+    hal_i2c_transfer_async(IMU_I2C_ADDR, &REG_FIFO_R_W, 1, __fifo_data,
+                           n * MPU6050_FIFO_SAMPLE_BYTES, __fifo_data_done);
+}
 
-static void imu_gpio_handler() {
-    // Acknowledge GPIO interrupt
-    gpio_acknowledge_irq(PIN_IMU_INT, GPIO_IRQ_EDGE_FALL);
 
-    // Acknowledge interrupt by writing to IMU_I2C_REG_INT_STATUS
-    // Should probably not do this in the ISR but rather via flag
-    uint8_t buf = MPU6050_REG_INT_STATUS;
-    uint8_t intmask;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &buf, 1, true);
-    i2c_read_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &intmask, 1, true);
+// Once the motion interrupts are handled, read out the FIFO if a burst is
+// due. Returns false if there was nothing to do.
+static bool __fifo_next() {
+    if (!__fifo_due)
+        return false;
+    __fifo_due = false;
 
+    // An overflowed FIFO no longer holds whole samples, start it over
+    if (__intmask & MPU6050_INT_FIFO_OFLOW) {
+        __samples_dropped += MPU6050_FIFO_SIZE / MPU6050_FIFO_SAMPLE_BYTES;
+        return hal_i2c_transfer_async(IMU_I2C_ADDR, FIFO_RESET, 2, NULL, 0,
+                                      __chain_done);
+    }
+    return hal_i2c_transfer_async(IMU_I2C_ADDR, &REG_FIFO_COUNTH, 1,
+                                  __fifo_count, 2, __fifo_count_done);
+}
+
+#endif /* IMU_FIFO_MODE */
+
+
+static void __check_pending() {
+    if (__int_pending) {
+        __int_pending = false;
+        __read_int_status();
+    }
+}
+
+
+// Last step of the chain. The bus is free again.
+static void __chain_done(bool ok) {
+    #ifdef IMU_FIFO_MODE
+        if (ok && __fifo_next())
+            return;
+    #endif
+    __check_pending();
+}
+
+
+static void __motion_status_done(bool ok) {
+    // Bit 0 of MOT_DETECT_STATUS tells whether it was a motion or zero-motion
+    // interrupt
+    if (ok && !(__motion_status & 0x01)) {
+        TRACE(TRACE_IMU_SWING, __motion_status);
+        events_post(EVENT_SWING, __motion_status);
+    }
+    __chain_done(ok);
+}
+
+
+static void __int_status_done(bool ok) {
     // Bit 6 is motion detect, bit 5 is zero-motion detect
-    // Prioritize clash over swing if intmask has both bits set
-    if (intmask & 0x40) {
-        __has_clash = true;
-        //printf("Clash detected!\n");
-    } 
-    else if (intmask & 0x20) {
-        // Read bit 0 of MOT_DETECT_STATUS to see whether it was a motion or zero-motion interrupt
-        buf = MPU6050_REG_MOT_DETECT_STATUS;
-        uint8_t motion_status;
-        i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &buf, 1, true);
-        i2c_read_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &motion_status, 1, true);
-        //printf("MOT_DETECT_STATUS: 0x%02x\n", motion_status);
-        //printf("MOT_ZRMOT: %d\n", motion_status & 0x01);
-
-        if (!(motion_status & 0x01)) {
-            __has_swing = true;
-            //printf("Swing detected!\n");
-        }
+    bool clash = ok && (__intmask & MPU6050_INT_MOT);
+    bool swing = ok && (__intmask & MPU6050_INT_ZMOT);
+    if (clash) {
+        TRACE(TRACE_IMU_CLASH, __intmask);
+        events_post(EVENT_CLASH, __intmask);
     }
 
-    //int16_t acceleration[3], gyro[3], temp;
-    //mpu6050_read_raw(acceleration, gyro, &temp);
+    // Prioritize clash over swing if intmask has both bits set. A FIFO burst
+    // spans several milliseconds though, and often holds both.
+    #ifndef IMU_FIFO_MODE
+        swing &= !clash;
+    #endif
+    if (swing) {
+        // The bus is free again, from the completion of the last transfer
+        hal_i2c_transfer_async(IMU_I2C_ADDR, &REG_MOT_DETECT_STATUS, 1,
+                               &__motion_status, 1, __motion_status_done);
+        return;
+    }
+    __chain_done(ok);
+}
+
+
+static void __read_int_status() {
+    if (!hal_i2c_transfer_async(IMU_I2C_ADDR, &REG_INT_STATUS, 1,
+                                &__intmask, 1, __int_status_done))
+        __int_pending = true;
+}
+
 
-    //printf("Acc. X = %d, Y = %d, Z = %d\n", acceleration[0], acceleration[1], acceleration[2]);
-    //printf("Gyro. X = %d, Y = %d, Z = %d\n", gyro[0], gyro[1], gyro[2]);
-    //printf("Temp. = %f\n", (temp / 340.0) + 36.53);
+// Only kicks off the reads, the ISR returns right away
+static void imu_gpio_handler() {
+    #ifdef IMU_FIFO_MODE
+        // INT pulses on every sample; only read once a burst is in the FIFO.
+        // Motion interrupts are picked up then too.
+        __n_ready++;
+        if (__n_ready < IMU_FIFO_BURST)
+            return;
+        __n_ready = 0;
+        __fifo_due = true;
+    #endif
+
+    TRACE(TRACE_IMU_INT, 0);
+    __read_int_status();
+}
+
+
+// After blocking transfers from the main loop, or anything else holding the
+// bus, catch up on an interrupt that couldn't be handled meanwhile. The INT
+// pin stays low until then.
+void imu_resume_interrupts() {
+    uint32_t status = hal_irq_disable();
+    if (__int_pending || !hal_gpio_get(PIN_IMU_INT)) {
+        __int_pending = false;
+        __read_int_status();
+    }
+    hal_irq_restore(status);
 }
 
 
 void imu_i2c_init() {
-    i2c_init(I2C_IMU_INST, IMU_I2C_CLK_FREQ_KHZ * 1000);
-    gpio_set_function(PIN_IMU_SDA, GPIO_FUNC_I2C);
-    gpio_set_function(PIN_IMU_SCL, GPIO_FUNC_I2C);
-    // Unnecessary, there are external PU
-    //gpio_pull_up(PIN_IMU_SDA);
-    //gpio_pull_up(PIN_IMU_SCL);
+    hal_i2c_init(IMU_I2C_CLK_FREQ_KHZ * 1000);
 }
 
 
 void imu_reset() {
     uint8_t buf[] = {MPU6050_REG_PWR_MGMT_1, 0x80};
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Wait until IMU_I2C_REG_PWR_MGMT_1[7] is cleared
     uint8_t reset;
     uint8_t reset_counter = 0;
     do {
-        i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &buf[0], 1, true);
-        i2c_read_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &reset, 1, false);
+        hal_i2c_write_read(IMU_I2C_ADDR, &buf[0], 1, &reset, 1);
         reset_counter++;
-        sleep_ms(IMU_N_RESET_DELAY_MS);
+        hal_sleep_ms(IMU_N_RESET_DELAY_MS);
         //printf("Reset: 0x%02x\n", reset);
     } while ((reset & 0x80) && (reset_counter < IMU_N_RESET_TIMEOUT));
 
@@ -93,54 +239,90 @@ void imu_reset() {
     // Oddly even though the prinf above shows the bit is cleared, it isn't
     // and this is needed to get the IMU to work
     buf[1] = reset & ~0x40;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
-    i2c_read_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &reset, 1, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+    hal_i2c_write_read(IMU_I2C_ADDR, &buf[0], 1, &reset, 1);
     //printf("Reset (after clear SLEEP): 0x%02x\n", reset);
 
     // Wait a bit as recommended in the register map for SPI mode
-    sleep_ms(100);
+    hal_sleep_ms(100);
 
     // Signal path reset
     buf[0] = MPU6050_REG_SIGNAL_PATH_RESET;
     buf[1] = 0x07;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Wait a bit as recommended in the register map for SPI mode
-    sleep_ms(100);
+    hal_sleep_ms(100);
 }
 
 
+#ifdef IMU_FIFO_MODE
+static void __configure_fifo() {
+    // Digital low pass filter at 184 Hz accel / 188 Hz gyro, which also sets
+    // the gyro output rate to 1 kHz
+    uint8_t buf[] = {MPU6050_REG_CONFIG, 0x01};
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+
+    buf[0] = MPU6050_REG_SMPLRT_DIV;
+    buf[1] = (1000 / IMU_FIFO_ODR_HZ) - 1;
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+
+    buf[0] = MPU6050_REG_GYRO_CONFIG;
+    buf[1] = IMU_FIFO_GYRO_FS_SEL << 3;
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+
+    // Gyro X, Y, Z and accelerometer into the FIFO
+    buf[0] = MPU6050_REG_FIFO_EN;
+    buf[1] = 0x78;
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+
+    // Enable and reset the FIFO
+    hal_i2c_write(IMU_I2C_ADDR, FIFO_RESET, 2);
+
+    __n_ready = 0;
+    __fifo_due = false;
+    __samples_head = 0;
+    __samples_tail = 0;
+    __samples_dropped = 0;
+}
+#endif
+
+
 void imu_configure_interrupt() {
     // Active low push pull, latching interrupt signal
     uint8_t buf[] = {MPU6050_REG_INT_PIN_CFG, 0x20};
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
-    // Set a 5 Hz digital HPF (lower 3 bits in ACCEL_CONFIG)
+    // Set a 5 Hz digital HPF (lower 3 bits in ACCEL_CONFIG). It only feeds
+    // the motion detection, not the samples.
     buf[0] = MPU6050_REG_ACCEL_CONFIG;
     buf[1] = 0x01;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    #ifdef IMU_FIFO_MODE
+        buf[1] |= (IMU_FIFO_ACCEL_FS_SEL << 3);
+    #endif
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Set motion threshold (8-bit unsigned)
     buf[0] = MPU6050_REG_MOT_THR;
     buf[1] = IMU_THRESH_CLASH;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Set motion duration in milliseconds
     buf[0] = MPU6050_REG_MOT_DUR;
     buf[1] = IMU_N_CLASH_DUR;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // -------------------------------------------------------------------------
     // Also configure a zero-motion interrupt
     // Set zero-motion threshold (8-bit unsigned)
     buf[0] = MPU6050_REG_ZRMOT_THR;
     buf[1] = IMU_THRESH_SWING;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Set zero-motion duration in units of 64 milliseconds
     buf[0] = MPU6050_REG_ZRMOT_DUR;
     buf[1] = IMU_N_SWING_DUR;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
     // -------------------------------------------------------------------------
 
     // Configure other motion detection settings
@@ -148,73 +330,86 @@ void imu_configure_interrupt() {
     // Lower nibble - free fall and motion detect decrement count rate of 1ms
     buf[0] = MPU6050_REF_MOT_DETECT_CTRL;
     buf[1] = 0x15;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Enable motion detection interrupt (bit 6) and zero-motion detection interrupt (bit 5)
     buf[0] = MPU6050_REG_INT_ENABLE;
-    buf[1] = 0x60;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    buf[1] = MPU6050_INT_MOT | MPU6050_INT_ZMOT;
+    #ifdef CLASH_DETECT_MCU
+        // Clashes are picked out of the samples instead
+        buf[1] &= ~MPU6050_INT_MOT;
+    #endif
+    #ifdef IMU_FIFO_MODE
+        buf[1] |= MPU6050_INT_FIFO_OFLOW | MPU6050_INT_DATA_RDY;
+    #endif
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 
     // Make INT pin active low
     buf[0] = MPU6050_REG_INT_PIN_CFG;
     buf[1] = 0xa0;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    #ifdef IMU_FIFO_MODE
+        // 50 us pulses rather than latched, counted without any I2C
+        buf[1] = 0x80;
+    #endif
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+
+    #ifdef IMU_FIFO_MODE
+        __configure_fifo();
+    #endif
 
     // Configure interrupt pin
-    gpio_init(PIN_IMU_INT);
-    gpio_set_dir(PIN_IMU_INT, GPIO_IN);
-    gpio_set_irq_enabled_with_callback(PIN_IMU_INT, GPIO_IRQ_EDGE_FALL, true, &imu_gpio_handler);
+    hal_gpio_init(PIN_IMU_INT, false);
+    hal_gpio_irq_falling(PIN_IMU_INT, &imu_gpio_handler);
+    imu_resume_interrupts();
 }
 
 
 inline void imu_goto_sleep() {
     // Set sleep bit in PWR_MGMT_1
     uint8_t buf[] = {MPU6050_REG_PWR_MGMT_1, 0x40};
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
 }
 
 inline void imu_wake_up() {
     // Clear sleep bit in PWR_MGMT_1
     uint8_t buf[] = {MPU6050_REG_PWR_MGMT_1, 0x00};
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &buf[0], 1, true);
-    i2c_read_blocking(I2C_IMU_INST, IMU_I2C_ADDR, &buf[1], 1, false);
+    hal_i2c_write_read(IMU_I2C_ADDR, &buf[0], 1, &buf[1], 1);
     buf[1] = buf[1] & ~0x40;
-    i2c_write_blocking(I2C_IMU_INST, IMU_I2C_ADDR, buf, 2, false);
-    return;
+    hal_i2c_write(IMU_I2C_ADDR, buf, 2);
+
+    #ifdef IMU_FIFO_MODE
+        // Drop whatever was left from before sleeping
+        hal_i2c_write(IMU_I2C_ADDR, FIFO_RESET, 2);
+        __n_ready = 0;
+    #endif
+    imu_resume_interrupts();
 }
 
 
-inline bool imu_has_clash() {
-    bool flag = false;
-    uint32_t status = save_and_disable_interrupts();
-    if (__has_clash) {
-        __has_clash = false;
-        flag = true;
-    }
-    restore_interrupts(status);
-    return flag;
-}
+#ifdef IMU_FIFO_MODE
+uint32_t imu_read_samples(imu_sample_t* dst, uint32_t max) {
+    uint32_t t = __samples_tail;
+    uint32_t n = 0;
 
-inline bool imu_has_swing() {
-    bool flag = false;
-    uint32_t status = save_and_disable_interrupts();
-    if (__has_swing) {
-        __has_swing = false;
-        flag = true;
+    while ((n < max) && (t != __samples_head)) {
+        __sync_synchronize();
+        dst[n++] = __samples[t & (IMU_SAMPLE_BUFFER_LEN - 1)];
+        t++;
     }
-    restore_interrupts(status);
-    return flag;
+    __sync_synchronize();
+    __samples_tail = t;
+    return n;
 }
 
-inline void imu_clear_clash() {
-    __has_clash = false;
+uint32_t imu_samples_dropped() {
+    return __samples_dropped;
 }
-
-inline void imu_clear_swing() {
-    __has_swing = false;
+#else
+uint32_t imu_read_samples(imu_sample_t* dst, uint32_t max) {
+    return 0;
 }
 
-inline void imu_clear_motion() {
-    __has_clash = false;
-    __has_swing = false;
+uint32_t imu_samples_dropped() {
+    return 0;
 }
+#endif
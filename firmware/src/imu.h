@@ -7,20 +7,42 @@
 #define _IMU_H_
 
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MPU6050_REG_SMPLRT_DIV            0x19
+#define MPU6050_REG_CONFIG                0x1a
+#define MPU6050_REG_GYRO_CONFIG           0x1b
 #define MPU6050_REG_ACCEL_CONFIG          0x1c
 #define MPU6050_REG_MOT_THR               0x1f
 #define MPU6050_REG_MOT_DUR               0x20
 #define MPU6050_REG_ZRMOT_THR             0x21
 #define MPU6050_REG_ZRMOT_DUR             0x22
+#define MPU6050_REG_FIFO_EN               0x23
 #define MPU6050_REG_INT_PIN_CFG           0x37
 #define MPU6050_REG_INT_ENABLE            0x38
 #define MPU6050_REG_INT_STATUS            0x3a
+#define MPU6050_REG_ACCEL_XOUT_H          0x3b
+#define MPU6050_REG_GYRO_XOUT_H           0x43
 #define MPU6050_REG_MOT_DETECT_STATUS     0x61
 #define MPU6050_REF_MOT_DETECT_CTRL       0x69
 #define MPU6050_REG_PWR_MGMT_1            0x6B
 #define MPU6050_REG_SIGNAL_PATH_RESET     0x68
+#define MPU6050_REG_USER_CTRL             0x6a
+#define MPU6050_REG_FIFO_COUNTH           0x72
+#define MPU6050_REG_FIFO_R_W              0x74
 #define MPU6050_REG_WHOAMI                0x75
 
+// INT_ENABLE / INT_STATUS bits
+#define MPU6050_INT_MOT                   0x40
+#define MPU6050_INT_ZMOT                  0x20
+#define MPU6050_INT_FIFO_OFLOW            0x10
+#define MPU6050_INT_DATA_RDY              0x01
+
+// Accelerometer then gyro, each X, Y, Z big endian, as written to the FIFO
+#define MPU6050_FIFO_SAMPLE_BYTES         12
+#define MPU6050_FIFO_SIZE                 1024
+
 
 #define IMU_N_RESET_TIMEOUT             10      // Try this many times to reset
 #define IMU_N_RESET_DELAY_MS            10      // Delay in ms
@@ -31,13 +53,19 @@ void imu_reset();
 void imu_configure_interrupt();
 void imu_goto_sleep();
 void imu_wake_up();
+void imu_resume_interrupts();           // After holding the bus, see imu.c
+
 
-bool imu_has_clash();
-bool imu_has_swing();
+// One sample from the FIFO, in the full scale ranges of IMU_FIFO_ACCEL_FS_SEL
+// and IMU_FIFO_GYRO_FS_SEL
+typedef struct {
+    int16_t accel[3];
+    int16_t gyro[3];
+} imu_sample_t;
 
-void imu_clear_clash();
-void imu_clear_swing();
-void imu_clear_motion();
+// Take samples streamed from the FIFO. EVENT_IMU_DATA is posted as they come.
+uint32_t imu_read_samples(imu_sample_t* dst, uint32_t max);
+uint32_t imu_samples_dropped();
 
 #endif /* _IMU_H_ */
 
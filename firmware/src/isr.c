@@ -3,11 +3,9 @@
  * @brief Interrupt Service Routines
  */
 
-#include "pico/stdlib.h"
-
 #include "tick.h"
-#include "ledstrip.h"
 #include "button.h"
+#include "clocks.h"
 
 
 #define TICK_COUNT_TOP 100
@@ -22,8 +20,8 @@ void isr_tick() {
     //    gpio_xor_mask(1 << PICO_DEFAULT_LED_PIN);
     //}
 
-    ledstrip_handler();
     btn_handler();
+    clocks_tick();
 }
 
 
@@ -4,16 +4,19 @@
  */
 
 
-#include "pico/stdlib.h"
-#include "hardware/sync.h"
-#include "hardware/pio.h"
-#include "ws2812.pio.h"
+#include <string.h>
 
+#include "hal.h"
 #include "config.h"
 #include "pinmap.h"
 #include "utilities.h"
 
 #include "ledstrip.h"
+#include "effects.h"
+#include "gamma.h"
+#include "power.h"
+#include "strands.h"
+#include "trace.h"
 
 
 #ifndef SABER_DARK_SIDE
@@ -50,41 +53,136 @@
 #endif
 
 
-volatile bool __do_turn_on = false;
-volatile bool __do_turn_off = false;
-
-volatile uint32_t __led_counter = 0;
 volatile uint32_t __led_color_idx = 0;
 
-volatile uint32_t __led_tick_count = 0;
+// Render tick time
+static volatile uint32_t __now_ms = 0;
+
+// Last frame rendered, to skip sending one that hasn't changed
+static led_color_t __line[N_LEDSTRIP_LEDS];
+static led_color_t __duty[N_LEDSTRIP_LEDS];
+static uint32_t __grb[N_LEDSTRIP_LEDS];
+static uint32_t __prev_grb[N_LEDSTRIP_LEDS];
+static bool __shown = false;
+
 
-volatile uint32_t __led_flash_tick_count = 0;
-volatile uint32_t __led_flash_count = 0;
-volatile bool __do_flash = false;
-volatile bool __flash_on = false;
+// Double buffered: frames are rendered into the back buffer while the front
+// one is sent out by DMA. A frame rendered while the strip is busy is late: it
+// waits in the back buffer for the end of the previous one, and is dropped if
+// a newer one comes first.
+static uint32_t __pixels[LEDSTRIP_N_STRANDS][N_LEDSTRIP_LEDS];
+static uint32_t __frames[2][STRANDS_FRAME_WORDS];
+static uint8_t __back = 0;
+static bool __pending = false;
+static uint32_t __pending_pixels;
 
+static ledstrip_stats_t __stats;
 
-static inline void __put_pixel(uint32_t pixel_grb) {
-    pio_sm_put_blocking(pio0, 0, pixel_grb << 8u);
+
+static void __send_back(uint32_t n_pixels) {
+    if (hal_led_show(__frames[__back], STRANDS_FRAME_WORDS)) {
+        #ifdef TRACE_LED_FRAMES
+            TRACE(TRACE_LED_SHOW, n_pixels);
+        #endif
+        __stats.frames++;
+        __back ^= 1;
+        __pending = false;
+    } else if (__pending) {
+        __stats.dropped++;
+        TRACE(TRACE_LED_DROP, __stats.dropped);
+        __pending_pixels = n_pixels;
+    } else {
+        __stats.late++;
+        TRACE(TRACE_LED_LATE, __stats.late);
+        __pending = true;
+        __pending_pixels = n_pixels;
+    }
 }
 
-static inline void __fill_pixels(uint32_t pixel_grb, uint32_t n_pixels) {
-    for (uint32_t i = 0; i < n_pixels; i++) {
-        __put_pixel(pixel_grb);
+
+// Called from the interrupt once a frame is out
+static void __frame_done() {
+    #ifdef TRACE_LED_FRAMES
+        TRACE(TRACE_LED_DONE, 0);
+    #endif
+    if (__pending)
+        __send_back(__pending_pixels);
+}
+
+
+// Composite the effects into a frame, and send it if it changed. Every
+// strand the same, for even light.
+static void __render() {
+    uint32_t lit = effects_render(__now_ms, __line);
+    gamma_correct(__line, __duty, N_LEDSTRIP_LEDS);
+
+    uint32_t requested_ma;
+    uint32_t ma = power_limit(__duty, N_LEDSTRIP_LEDS, &requested_ma);
+    if (ma > __stats.peak_ma)
+        __stats.peak_ma = ma;
+    if (requested_ma > __stats.peak_requested_ma)
+        __stats.peak_requested_ma = requested_ma;
+    if (requested_ma > LEDSTRIP_CURRENT_BUDGET_MA) {
+        __stats.limited++;
+        TRACE(TRACE_LED_LIMIT, requested_ma);
     }
-    for (uint32_t i = n_pixels; i < N_LEDSTRIP_LEDS; i++) {
-        __put_pixel(LEDSTRIP_COLOR_OFF);
+
+    gamma_dither(__duty, __grb, N_LEDSTRIP_LEDS);
+    if (__shown && (memcmp(__grb, __prev_grb, sizeof(__grb)) == 0))
+        return;
+    memcpy(__prev_grb, __grb, sizeof(__grb));
+    __shown = true;
+
+    for (uint8_t s = 0; s < LEDSTRIP_N_STRANDS; s++) {
+        memcpy(__pixels[s], __grb, sizeof(__grb));
     }
+    strands_transpose(__pixels, __frames[__back]);
+    __send_back(lit);
 }
 
 
-void ledstrip_init() {
-    PIO pio = pio0;
-    int sm = 0;
-    uint offset = pio_add_program(pio, &ws2812_program);
+// Called from the render tick interrupt. It stops once no effect is left.
+static bool __render_tick() {
+    __now_ms += LEDSTRIP_FRAME_MS;
+    __render();
+    return effects_active();
+}
+
+
+// Start an effect, and the render tick with it. Also called from the main
+// loop, so keep the render tick out meanwhile.
+static void __start(effect_layer_t layer, effect_render_t render,
+                    uint32_t color) {
+    uint32_t status = hal_irq_disable();
+    effects_start(layer, render, LED_COLOR(color), __now_ms);
+    hal_irq_restore(status);
+    hal_led_timer_start(LEDSTRIP_FRAME_MS * 1000, __render_tick);
+}
+
 
-    // Not an RGBW strip
-    ws2812_program_init(pio, sm, offset, PIN_LEDSTRIP, 800000, false);
+// The render tick runs on for a frame without it
+static void __stop(effect_layer_t layer) {
+    uint32_t status = hal_irq_disable();
+    effects_stop(layer);
+    hal_irq_restore(status);
+    hal_led_timer_start(LEDSTRIP_FRAME_MS * 1000, __render_tick);
+}
+
+
+void ledstrip_init() {
+    hal_led_timer_stop();
+    __back = 0;
+    __pending = false;
+    __shown = false;
+    __stats.frames = 0;
+    __stats.late = 0;
+    __stats.dropped = 0;
+    __stats.peak_ma = 0;
+    __stats.peak_requested_ma = 0;
+    __stats.limited = 0;
+    hal_led_init(__frame_done);
+    effects_reset();
+    gamma_init();
 
     // If picking a random color, do it
     // Modulo N_LEDSTRIP_COLORS - 1 with last color red, so never red on start
@@ -97,14 +195,10 @@ void ledstrip_init() {
         __led_color_idx = N_LEDSTRIP_COLORS - 1;
     #endif
 
-    __do_turn_on = false;
-    __do_turn_off = false;
-    __led_counter = 0;
-    __led_tick_count = 0;
-    __do_flash = false;
-
     // Turn off all LEDs
-    __fill_pixels(LEDSTRIP_COLOR_OFF, N_LEDSTRIP_LEDS);
+    uint32_t status = hal_irq_disable();
+    __render();
+    hal_irq_restore(status);
 }
 
 
@@ -116,114 +210,75 @@ void ledstrip_set_random_color() {
 
 
 void ledstrip_clear() {
-    __do_turn_on = false;
-    __do_turn_off = false;
-    __led_counter = 0;
-    __led_tick_count = 0;
-    __fill_pixels(LEDSTRIP_COLOR_OFF, N_LEDSTRIP_LEDS);
+    uint32_t status = hal_irq_disable();
+    effects_reset();
+    hal_irq_restore(status);
+    hal_led_timer_start(LEDSTRIP_FRAME_MS * 1000, __render_tick);
 }
 
 
 void ledstrip_turn_on() {
-    if ((__do_turn_on == false) && (__do_turn_off == false)) {
-        __do_turn_on = true;
-        __led_counter = 0;
+    if (!effects_running(EFFECT_LAYER_BLADE, effect_ignition)) {
+        __start(EFFECT_LAYER_BLADE, effect_ignition,
+                __LEDSTRIP_COLORS[__led_color_idx]);
+        #ifdef LEDSTRIP_FLICKER
+            __start(EFFECT_LAYER_FLICKER, effect_flicker, LEDSTRIP_COLOR_OFF);
+        #endif
+        #ifdef LEDSTRIP_AUDIO_REACTIVE
+            __start(EFFECT_LAYER_AUDIO, effect_audio, LEDSTRIP_COLOR_OFF);
+        #endif
     }
 }
 
 void ledstrip_turn_off() {
-    if ((__do_turn_on == false) && (__do_turn_off == false)) {
-        __do_turn_off = true;
-        __led_counter = N_LEDSTRIP_LEDS;
+    if (effects_running(EFFECT_LAYER_BLADE, effect_ignition)) {
+        __stop(EFFECT_LAYER_FLICKER);
+        __stop(EFFECT_LAYER_AUDIO);
+        __stop(EFFECT_LAYER_LOCKUP);
+        __start(EFFECT_LAYER_BLADE, effect_retraction,
+                __LEDSTRIP_COLORS[__led_color_idx]);
     }
 }
 
-// Assumes LEDs are filled in, so fill them 
+// Takes effect on the lit blade at the next frame
 void ledstrip_next_color() {
 // Only change the color if not dark side mode
 #ifndef SABER_DARK_SIDE
     __led_color_idx++;
     if (__led_color_idx >= N_LEDSTRIP_COLORS)
         __led_color_idx = 0;
-    __fill_pixels(__LEDSTRIP_COLORS[__led_color_idx], N_LEDSTRIP_LEDS);
+    uint32_t status = hal_irq_disable();
+    effects_set_color(EFFECT_LAYER_BLADE, LED_COLOR(__LEDSTRIP_COLORS[__led_color_idx]));
+    hal_irq_restore(status);
 #endif
 }
 
 
 #ifdef LEDSTRIP_FLASH_ON_CLASH
 void ledstrip_flash() {
-    uint32_t status = save_and_disable_interrupts();
-    __do_flash = true;
-    __led_flash_count = rand_powof2_range(0, N_LEDSTRIP_FLASH_MAX) + 1;
-    __led_flash_tick_count = rand_powof2_range(N_LEDSTRIP_FLASH_MIN_MS, N_LEDSTRIP_FLASH_MAX_MS);
-    __flash_on = false;
-    restore_interrupts(status);
+    __start(EFFECT_LAYER_FLASH, effect_flash,
+            __LEDSTRIP_FLASH_COLORS[__led_color_idx]);
 }
 #endif
 
 
-// Call in a millisecond interrupt
-void ledstrip_handler() {
-    // If turning on, turn on one LED at a time when counter hits top
-    if (__do_turn_on) {
-        __led_tick_count++;
-        if (__led_tick_count >= N_LEDSTRIP_TURN_ON_MS) {
-            __led_counter++;
-            __led_tick_count = 0;
-            __fill_pixels(__LEDSTRIP_COLORS[__led_color_idx], __led_counter);
-            if (__led_counter == N_LEDSTRIP_LEDS)
-                __do_turn_on = false;
-        }
-    } 
-
-    // If turning off, turn off one LED at a time when counter hits top
-    else if (__do_turn_off) {
-        __led_tick_count++;
-        if (__led_tick_count >= N_LEDSTRIP_TURN_OFF_MS) {
-            __led_counter--;
-            __led_tick_count = 0;
-            __fill_pixels(__LEDSTRIP_COLORS[__led_color_idx], __led_counter);
-            if (__led_counter == 0)
-                __do_turn_off = false;
-        }
-    }
+void ledstrip_blast() {
+    __start(EFFECT_LAYER_BLAST, effect_blast,
+            __LEDSTRIP_FLASH_COLORS[__led_color_idx]);
+}
 
-    else {
-        __led_tick_count = 0;
-
-        #ifdef LEDSTRIP_FLASH_ON_CLASH
-        // If flashing, flash the LEDs
-        if (__do_flash) {
-            __led_flash_tick_count--;
-            if (__led_flash_tick_count == 0) {
-                // If the flash is currently on, decrement flash count, done with one iteration
-                if ( __flash_on) {
-                    __led_flash_count--;
-                }
-                // If flash count has hit zero, done flashing
-                if (__led_flash_count == 0) {
-                    __do_flash = false;
-                    __fill_pixels(__LEDSTRIP_COLORS[__led_color_idx], N_LEDSTRIP_LEDS);
-                } else {
-                    // If flash is currently high, turn it off
-                    if (__flash_on) {
-                        // Compute new flash tick count for delay between flashes
-                        __led_flash_tick_count = rand_powof2_range(
-                                                    N_LEDSTRIP_FLASH_DELAY_MIN_MS, 
-                                                    N_LEDSTRIP_FLASH_DELAY_MAX_MS);
-                        __fill_pixels(__LEDSTRIP_COLORS[__led_color_idx], N_LEDSTRIP_LEDS);
-                        __flash_on = false;
-                    } else {
-                        // Compute new flash tick count for duration
-                        __led_flash_tick_count = rand_powof2_range(
-                                                    N_LEDSTRIP_FLASH_MIN_MS, 
-                                                    N_LEDSTRIP_FLASH_MAX_MS);
-                        __fill_pixels(__LEDSTRIP_FLASH_COLORS[__led_color_idx], N_LEDSTRIP_LEDS);
-                        __flash_on = true;
-                    }
-                }
-            }
-        }
-        #endif
-    }
+
+void ledstrip_lockup(bool on) {
+    if (on)
+        __start(EFFECT_LAYER_LOCKUP, effect_lockup,
+                __LEDSTRIP_FLASH_COLORS[__led_color_idx]);
+    else
+        __stop(EFFECT_LAYER_LOCKUP);
+}
+
+
+void ledstrip_get_stats(ledstrip_stats_t* stats) {
+    uint32_t status = hal_irq_disable();
+    *stats = __stats;
+    hal_irq_restore(status);
 }
@@ -8,19 +8,26 @@
 #define _LEDSTRIP_H_
 
 
-// Custom 24-bit GRB colors
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+
+// Custom 24-bit GRB colors, perceptual: they go through the gamma curve to
+// at most LEDSTRIP_BRIGHTNESS, see gamma.h
 #define LEDSTRIP_COLOR_OFF      0x000000
 
-#define LEDSTRIP_COLOR_BLUE     0x000020
-#define LEDSTRIP_COLOR_GREEN    0x200000
-#define LEDSTRIP_COLOR_PURPLE   0x001010
-#define LEDSTRIP_COLOR_TEAL     0x100010
-#define LEDSTRIP_COLOR_YELLOW   0x202000
-#define LEDSTRIP_COLOR_WHITE    0x0d0d0d
-#define LEDSTRIP_COLOR_ORANGE   0x082000
-#define LEDSTRIP_COLOR_PINK     0x042004
+#define LEDSTRIP_COLOR_BLUE     0x00007b
+#define LEDSTRIP_COLOR_GREEN    0x7b0000
+#define LEDSTRIP_COLOR_PURPLE   0x005a5a
+#define LEDSTRIP_COLOR_TEAL     0x5a005a
+#define LEDSTRIP_COLOR_YELLOW   0x7b7b00
+#define LEDSTRIP_COLOR_WHITE    0x515151
+#define LEDSTRIP_COLOR_ORANGE   0x417b00
+#define LEDSTRIP_COLOR_PINK     0x307b30
 
-#define LEDSTRIP_COLOR_RED      0x002000
+#define LEDSTRIP_COLOR_RED      0x007b00
 
 #ifndef SABER_DARK_SIDE
     #define N_LEDSTRIP_COLORS 9
@@ -29,21 +36,50 @@
 #endif
 
 // Colors for brief higher-intensity clashes
-#define LEDSTRIP_FLASH_BLUE     0x202060
-#define LEDSTRIP_FLASH_GREEN    0xa00000
-#define LEDSTRIP_FLASH_PURPLE   0x206060
-#define LEDSTRIP_FLASH_TEAL     0x602060
-#define LEDSTRIP_FLASH_YELLOW   0x606000
-#define LEDSTRIP_FLASH_WHITE    0x606060
-#define LEDSTRIP_FLASH_ORANGE   0x306010
-#define LEDSTRIP_FLASH_PINK     0x106010
+#define LEDSTRIP_FLASH_BLUE     0x7b7bca
+#define LEDSTRIP_FLASH_GREEN    0xff0000
+#define LEDSTRIP_FLASH_PURPLE   0x7bcaca
+#define LEDSTRIP_FLASH_TEAL     0xca7bca
+#define LEDSTRIP_FLASH_YELLOW   0xcaca00
+#define LEDSTRIP_FLASH_WHITE    0xcacaca
+#define LEDSTRIP_FLASH_ORANGE   0x94ca5a
+#define LEDSTRIP_FLASH_PINK     0x5aca5a
 
-#define LEDSTRIP_FLASH_RED      0x00a000
+#define LEDSTRIP_FLASH_RED      0x00ff00
 
 #define N_LEDSTRIP_FLASH_TIMEOUT_MS     300
 
 
+// Colors inside the LED pipeline, 16 bits per perceptual channel
+typedef struct {
+    uint16_t g, r, b;
+} led_color_t;
+
+#define LED_COLOR(grb)          ((led_color_t) { \
+                                    .g = (((grb) >> 16) & 0xff) * 257, \
+                                    .r = (((grb) >> 8) & 0xff) * 257, \
+                                    .b = ((grb) & 0xff) * 257 })
+
+
+// Time to send a frame, and the render tick period: the shortest whole number
+// of milliseconds that fits a frame, and no shorter than LEDSTRIP_MAX_FPS
+// allows
+#define LEDSTRIP_FRAME_US       ((uint32_t) ((N_LEDSTRIP_LEDS * 24 * 1000000ull) \
+                                    / LEDSTRIP_BIT_RATE_HZ) + LEDSTRIP_RESET_US)
+#define LEDSTRIP_FRAME_MIN_MS   ((LEDSTRIP_FRAME_US + 999) / 1000)
+#define LEDSTRIP_FRAME_MS       ((LEDSTRIP_FRAME_MIN_MS > 1000 / LEDSTRIP_MAX_FPS) \
+                                    ? LEDSTRIP_FRAME_MIN_MS : 1000 / LEDSTRIP_MAX_FPS)
+
 
+// Frame counts and current since ledstrip_init()
+typedef struct {
+    uint32_t frames;        // Sent to the strip
+    uint32_t late;          // Held up by the previous frame still being sent
+    uint32_t dropped;       // Replaced by a newer frame before being sent
+    uint32_t peak_ma;       // Highest current estimated for a frame, dimmed
+    uint32_t peak_requested_ma; // The same before dimming
+    uint32_t limited;       // Dimmed to LEDSTRIP_CURRENT_BUDGET_MA
+} ledstrip_stats_t;
 
 
 void ledstrip_init();
@@ -56,8 +92,12 @@ void ledstrip_set_random_color();
 #ifdef LEDSTRIP_FLASH_ON_CLASH
 void ledstrip_flash();
 #endif
+// A blaster bolt deflected somewhere along the blade
+void ledstrip_blast();
+// Blade locked against another, until called with false
+void ledstrip_lockup(bool on);
 
-void ledstrip_handler();
+void ledstrip_get_stats(ledstrip_stats_t* stats);
 
 
 #endif /* _LEDSTRIP_H_ */
@@ -6,14 +6,27 @@
 #include "ledstrip.h"
 #include "button.h"
 #include "speaker.h"
+#include "motion.h"
 #include "imu.h"
+#include "font.h"
+#include "trace.h"
+#include "events.h"
+#include "clocks.h"
 
-#include "pico/stdlib.h"
+#include "hal.h"
 #include <stdio.h>
 #include <string.h>
 #include "config.h"
 
-#include "hardware/rosc.h"
+
+// Motion sounds are mixed on top of the hum, which keeps playing
+void on_clash() {
+    TRACE(TRACE_MAIN_CLASH, 0);
+    spk_play_clash();
+    #ifdef LEDSTRIP_FLASH_ON_CLASH
+        ledstrip_flash();
+    #endif
+}
 
 
 void setup_turnon() {
@@ -27,6 +40,7 @@ void setup_turnon() {
     ledstrip_turn_on();
 
     // Hum sound starts playing automatically after power-on
+    motion_reset();
     spk_play_turnon();
 
     #ifdef IMU_RESET_ON_EVENT
@@ -46,10 +60,9 @@ void setup_turnon() {
     // poweron are only processed after the first hum sound has played all the
     // way through.
     // Should be longer than poweron tune length
-    sleep_ms(SYS_POWERON_DELAY);
+    hal_sleep_ms(SYS_POWERON_DELAY);
 
-    btn_clear_press();
-    imu_clear_motion();
+    events_clear();
 }
 
 
@@ -68,51 +81,79 @@ int main()
     #endif
     setup_turnon();
 
+    // Sleep until an interrupt posts an event, then handle it
     while (true) {
-        if (imu_has_clash()) {
-            spk_stop();
-            spk_play_clash();
-            #ifdef LEDSTRIP_FLASH_ON_CLASH
-                ledstrip_flash();
-            #endif
-        }
-        if (imu_has_swing()) {
-            spk_stop();
-            spk_play_swing();
+        event_t ev = events_wait();
+
+        switch (ev.type) {
+            case EVENT_CLASH:
+                on_clash();
+                break;
+
+            // With SmoothSwing, swings are heard from the gyro instead
+            case EVENT_SWING:
+                TRACE(TRACE_MAIN_SWING, 0);
+                #ifndef SMOOTHSWING_ENABLE
+                    spk_play_swing();
+                #endif
+                break;
+
+            // Only with a single core, see cores.h
+            case EVENT_IMU_DATA:
+                if (motion_process())
+                    on_clash();
+                break;
+
+            // Long press - change the LED strip color
+            case EVENT_BTN_LONG:
+                ledstrip_next_color();
+
+                #ifdef IMU_RESET_ON_EVENT
+                    imu_i2c_init();
+                    imu_reset();
+                    imu_configure_interrupt();
+                #endif
+                break;
+
+            // Keep holding - also switch to the next sound font, and restart
+            // the hum with it
+            case EVENT_BTN_EXTRA_LONG:
+                if (font_count() > 1) {
+                    font_next();
+                    spk_play_hum_repeat();
+                }
+                break;
+
+            // Short press - turn off
+            case EVENT_BTN_SHORT:
+                spk_stop();
+                events_clear();
+                spk_play_turnoff();
+                ledstrip_turn_off();
+
+                // Wait for the poweroff sound to end, dropping any motion or
+                // button events meanwhile
+                if (!spk_is_done_playing()) {
+                    while (events_wait().type != EVENT_SPK_DONE);
+                }
+                spk_disable();
+                #ifdef IMU_SLEEP
+                    imu_goto_sleep();
+                #endif
+
+                TRACE_DUMP();
+                sys_go_dormant();
+
+                // Code resumes here after any button press
+                setup_turnon();
+                break;
+
+            // Checked below, as after every event
+            case EVENT_CLOCKS:
+            default:
+                break;
         }
 
-        // After a motion, resume playing hum sound repeatedly
-        if (spk_is_done_playing()) {
-            spk_play_hum_repeat();
-        }
-
-        // Long press and release - change the LED strip color
-        if (btn_has_long_press()) {
-            ledstrip_next_color();
-            
-            #ifdef IMU_RESET_ON_EVENT
-                imu_i2c_init();
-                imu_reset();
-                imu_configure_interrupt();
-            #endif
-        }
-
-        // Short press - turn off
-        if (btn_has_short_press()) {
-            spk_stop();
-            spk_play_turnoff();
-            ledstrip_turn_off();
-
-            spk_wait_until_done_playing();
-            spk_disable();
-            #ifdef IMU_SLEEP
-                imu_goto_sleep();
-            #endif
-
-            sys_go_dormant();
-            
-            // Code resumes here after any button press
-            setup_turnon();
-        }
+        clocks_update();
     }
 }
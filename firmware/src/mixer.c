@@ -0,0 +1,328 @@
+/**
+ * @file mixer.c
+ * @brief Multi-voice software audio mixer
+ *
+ * Sums up to MIXER_N_VOICES sounds into signed 16-bit samples, each voice with
+ * its own Q8 gain. The sum saturates instead of wrapping. 8-bit PCM is played
+ * as the upper byte of 16-bit samples. ADPCM sounds are decoded on the fly, so
+ * a voice only reads the flash it actually plays.
+ *
+ * Gain changes ramp linearly over the next block rather than stepping, so
+ * that gains can be modulated continuously without clicks. A voice can also
+ * play at another rate than recorded, which shifts its pitch: samples are
+ * stepped through with a Q16 phase accumulator and held, without
+ * interpolation.
+ *
+ * Voices are started and stopped from the main loop while mixer_fill() runs
+ * in the audio interrupt. A voice is only picked up by the mixer once its
+ * `active` flag is set, so all other fields must be written before it.
+ *
+ * The envelope tracks of the sounds are only looked up by
+ * mixer_track_envelope(), from the LED strip, never while mixing.
+ */
+
+
+#include "mixer.h"
+#include "adpcm.h"
+#include "utilities.h"
+
+
+typedef struct {
+    const uint8_t* data;
+    uint32_t len;
+    uint32_t pos;
+    uint32_t frac;                      // Q16 phase between samples
+    uint32_t rate;
+    int32_t cur;                        // Sample being held
+    uint16_t gain;
+    uint16_t gain_target;
+    uint8_t format;
+    bool loop;
+    bool active;
+    adpcm_state_t adpcm;
+    const uint8_t* env;
+    uint32_t env_len;
+    uint8_t env_shift;
+    uint32_t seq;                       // Odd while mixer_play() rewrites it
+} mixer_voice_t;
+
+
+static volatile mixer_voice_t voices[MIXER_N_VOICES];
+
+
+void mixer_init() {
+    for (uint8_t i = 0; i < MIXER_N_VOICES; i++) {
+        voices[i].active = false;
+        voices[i].data = 0;
+        voices[i].len = 0;
+        voices[i].pos = 0;
+        voices[i].frac = 0;
+        voices[i].rate = MIXER_RATE_UNITY;
+        voices[i].cur = 0;
+        voices[i].gain = MIXER_GAIN_UNITY;
+        voices[i].gain_target = MIXER_GAIN_UNITY;
+        voices[i].format = SOUND_FMT_PCM8;
+        voices[i].loop = false;
+        voices[i].env = 0;
+        voices[i].env_len = 0;
+        voices[i].env_shift = 0;
+        voices[i].seq = 0;
+    }
+}
+
+
+void mixer_play(uint8_t voice, const sound_t* sound, uint16_t gain, bool loop) {
+    volatile mixer_voice_t* v = &voices[voice];
+
+    // Take the voice away from the mixer while it is being rewritten, and
+    // from mixer_track_envelope() on the other core
+    v->active = false;
+    v->seq++;
+    __sync_synchronize();
+    v->data = sound->data;
+    v->len = sound->len;
+    v->format = sound->format;
+    v->pos = 0;
+    v->frac = 0;
+    v->rate = MIXER_RATE_UNITY;
+    v->cur = 0;
+    v->gain = gain;
+    v->gain_target = gain;
+    v->loop = loop;
+    v->env = sound->env;
+    v->env_shift = sound->env_shift;
+    v->env_len = (sound->len + (1u << sound->env_shift) - 1) >> sound->env_shift;
+    __sync_synchronize();
+    v->seq++;
+    v->active = (sound->len > 0);
+}
+
+void mixer_stop(uint8_t voice) {
+    voices[voice].active = false;
+}
+
+void mixer_stop_all() {
+    for (uint8_t i = 0; i < MIXER_N_VOICES; i++) {
+        voices[i].active = false;
+    }
+}
+
+// Reached by the end of the next block
+void mixer_set_gain(uint8_t voice, uint16_t gain) {
+    voices[voice].gain_target = gain;
+}
+
+void mixer_set_rate(uint8_t voice, uint32_t rate) {
+    voices[voice].rate = rate;
+}
+
+
+bool mixer_is_active(uint8_t voice) {
+    return voices[voice].active;
+}
+
+bool mixer_is_idle() {
+    for (uint8_t i = 0; i < MIXER_N_VOICES; i++) {
+        if (voices[i].active)
+            return false;
+    }
+    return true;
+}
+
+
+// Called from the LED strip, possibly on the other core while voices are
+// mixed or restarted: the level of a voice can be a block stale, and the
+// position is kept within its track. The track of a voice is read between
+// two equal, even sequence counts, so that it all belongs to one sound; a
+// voice being restarted meanwhile counts as silent.
+uint16_t mixer_track_envelope() {
+    uint32_t sq = 0;
+
+    for (uint8_t i = 0; i < MIXER_N_VOICES; i++) {
+        volatile mixer_voice_t* v = &voices[i];
+        uint32_t seq = v->seq;
+        __sync_synchronize();
+        const uint8_t* env = v->env;
+        uint32_t env_len = v->env_len;
+        uint8_t env_shift = v->env_shift;
+        uint32_t pos = v->pos;
+        uint32_t gain = v->gain_target;
+        bool active = v->active;
+        __sync_synchronize();
+        if ((seq & 1) || (v->seq != seq))
+            continue;
+        if (!active || (env == 0) || (env_len == 0))
+            continue;
+
+        uint32_t idx = pos >> env_shift;
+        if (idx >= env_len)
+            idx = env_len - 1;
+
+        // Voices add up as uncorrelated: the RMS of the mix is the root of
+        // the sum of their squares. Each saturates at full scale, as the
+        // mix does, so that they all fit.
+        uint32_t level = ((uint32_t) env[idx] * gain) >> 8;
+        if (level > 255)
+            level = 255;
+        sq += level * level;
+    }
+
+    uint32_t env = isqrt32(sq) << SOUND_ENV_LEVEL_SHIFT;
+    return (env > INT16_MAX) ? INT16_MAX : (uint16_t) env;
+}
+
+
+// Gain ramp over a block, Q16 so that small changes still move every sample
+static inline int32_t __ramp_step(volatile mixer_voice_t* v, uint32_t n) {
+    return (((int32_t) v->gain_target - (int32_t) v->gain) << 8) / (int32_t) n;
+}
+
+
+// Add up to n samples of an 8 or 16-bit PCM voice into acc. Returns false once
+// the voice has ended.
+static bool __mix_pcm(volatile mixer_voice_t* v, int32_t* acc, uint32_t n) {
+    const uint8_t* data = v->data;
+    bool wide = (v->format == SOUND_FMT_PCM16);
+    uint32_t len = v->len;
+    uint32_t pos = v->pos;
+    uint32_t frac = v->frac;
+    uint32_t rate = v->rate;
+    int32_t cur = v->cur;
+    int32_t gain = (int32_t) v->gain << 8;
+    int32_t step = __ramp_step(v, n);
+    bool playing = true;
+
+    for (uint32_t i = 0; i < n; i++) {
+        // Move on to the sample due, if any. At the recorded rate that is
+        // exactly one per output sample.
+        frac += rate;
+        while (frac >= MIXER_RATE_UNITY) {
+            frac -= MIXER_RATE_UNITY;
+            if (pos >= len) {
+                if (!v->loop) {
+                    playing = false;
+                    break;
+                }
+                pos = 0;
+            }
+            // 16-bit data is only byte aligned in compiled-in tunes
+            if (wide)
+                cur = (int16_t) (data[2 * pos] | (data[2 * pos + 1] << 8));
+            else
+                cur = ((int32_t) data[pos] - 128) << 8;
+            pos++;
+        }
+        if (!playing)
+            break;
+
+        gain += step;
+        acc[i] += (cur * (gain >> 8)) >> 8;
+    }
+
+    if ((pos >= len) && !v->loop)
+        playing = false;
+
+    v->pos = pos;
+    v->frac = frac;
+    v->cur = cur;
+    v->gain = v->gain_target;
+    return playing;
+}
+
+
+// Add up to n samples of an ADPCM voice into acc, decoding as we go
+static bool __mix_adpcm(volatile mixer_voice_t* v, int32_t* acc, uint32_t n) {
+    const uint8_t* data = v->data;
+    uint32_t len = v->len;
+    uint32_t pos = v->pos;
+    uint32_t frac = v->frac;
+    uint32_t rate = v->rate;
+    int32_t cur = v->cur;
+    int32_t gain = (int32_t) v->gain << 8;
+    int32_t step = __ramp_step(v, n);
+    adpcm_state_t st = v->adpcm;
+    bool playing = true;
+
+    // Position within the current block, and the block itself
+    uint32_t in_blk = pos % ADPCM_BLOCK_SAMPLES;
+    const uint8_t* blk = data + (pos / ADPCM_BLOCK_SAMPLES) * ADPCM_BLOCK_BYTES;
+
+    for (uint32_t i = 0; i < n; i++) {
+        // Samples skipped over at a higher rate must still be decoded
+        frac += rate;
+        while (frac >= MIXER_RATE_UNITY) {
+            frac -= MIXER_RATE_UNITY;
+            if (pos >= len) {
+                if (!v->loop) {
+                    playing = false;
+                    break;
+                }
+                pos = 0;
+                in_blk = 0;
+                blk = data;
+            }
+            if (in_blk == 0)
+                adpcm_block_start(&st, blk);
+
+            uint8_t code = blk[ADPCM_HEADER_BYTES + (in_blk >> 1)];
+            code = (in_blk & 1) ? (code >> 4) : (code & 0x0f);
+            cur = adpcm_decode(&st, code);
+
+            pos++;
+            in_blk++;
+            if (in_blk == ADPCM_BLOCK_SAMPLES) {
+                in_blk = 0;
+                blk += ADPCM_BLOCK_BYTES;
+            }
+        }
+        if (!playing)
+            break;
+
+        gain += step;
+        acc[i] += (cur * (gain >> 8)) >> 8;
+    }
+
+    if ((pos >= len) && !v->loop)
+        playing = false;
+
+    v->pos = pos;
+    v->frac = frac;
+    v->cur = cur;
+    v->gain = v->gain_target;
+    v->adpcm = st;
+    return playing;
+}
+
+
+// Mix n samples into out. Call from the audio interrupt.
+void mixer_fill(int16_t* out, uint32_t n) {
+    int32_t acc[n];
+
+    for (uint32_t i = 0; i < n; i++) {
+        acc[i] = 0;
+    }
+
+    for (uint8_t k = 0; k < MIXER_N_VOICES; k++) {
+        volatile mixer_voice_t* v = &voices[k];
+        if (!v->active)
+            continue;
+
+        bool playing;
+        if (v->format == SOUND_FMT_ADPCM)
+            playing = __mix_adpcm(v, acc, n);
+        else
+            playing = __mix_pcm(v, acc, n);
+
+        if (!playing)
+            v->active = false;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t s = acc[i];
+        if (s > INT16_MAX)
+            s = INT16_MAX;
+        else if (s < INT16_MIN)
+            s = INT16_MIN;
+        out[i] = (int16_t) s;
+    }
+}
@@ -0,0 +1,60 @@
+/**
+ * @file mixer.h
+ * @brief Multi-voice software audio mixer
+ */
+
+
+#ifndef MIXER_H
+#define MIXER_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+
+// Voice gains are Q8, 256 is unity
+#define MIXER_GAIN_UNITY        256
+// Playback rates are Q16, 65536 plays at the recorded pitch
+#define MIXER_RATE_UNITY        65536
+
+// Sample formats
+#define SOUND_FMT_PCM8          0       // Unsigned 8-bit, centered on 128
+#define SOUND_FMT_ADPCM         1       // 4-bit IMA-ADPCM blocks, see adpcm.h
+#define SOUND_FMT_PCM16         2       // Signed 16-bit, little endian
+
+// Envelope track levels are 8 bits of the 16-bit RMS
+#define SOUND_ENV_LEVEL_SHIFT   7
+
+
+// A sound stored in flash, optionally with an envelope track: one level per
+// 2^env_shift samples, see font.h
+typedef struct {
+    const uint8_t* data;
+    uint32_t len;                       // Length in samples
+    uint8_t format;                     // SOUND_FMT_*
+    uint8_t env_shift;
+    const uint8_t* env;                 // NULL without a track
+} sound_t;
+
+
+void mixer_init();
+
+void mixer_play(uint8_t voice, const sound_t* sound, uint16_t gain, bool loop);
+void mixer_stop(uint8_t voice);
+void mixer_stop_all();
+void mixer_set_gain(uint8_t voice, uint16_t gain);
+void mixer_set_rate(uint8_t voice, uint32_t rate);
+
+bool mixer_is_active(uint8_t voice);
+bool mixer_is_idle();
+
+// Envelope of the mix, full scale 32767, from the envelope tracks of the
+// sounds at their playback positions. Voices without a track count as silent.
+uint16_t mixer_track_envelope();
+
+void mixer_fill(int16_t* out, uint32_t n);
+
+
+#endif /* MIXER_H */
@@ -0,0 +1,55 @@
+/**
+ * @file motion.c
+ * @brief Processing of the IMU samples
+ */
+
+
+#include "config.h"
+#include "imu.h"
+#include "clash.h"
+#include "smoothswing.h"
+#include "speaker.h"
+#include "cores.h"
+#include "trace.h"
+#include "motion.h"
+
+
+void motion_reset() {
+    if (cores_call(CORES_MSG_MOTION_RESET, 0))
+        return;
+
+    #ifdef CLASH_DETECT_MCU
+        clash_reset();
+    #endif
+    #ifdef SMOOTHSWING_ENABLE
+        smoothswing_reset();
+    #endif
+}
+
+
+// Either way the sample buffer must be kept from filling up
+uint32_t motion_process() {
+    uint32_t clash = 0;
+
+    #ifdef IMU_FIFO_MODE
+        imu_sample_t samples[IMU_FIFO_BURST];
+        uint32_t n;
+
+        while ((n = imu_read_samples(samples, IMU_FIFO_BURST)) > 0) {
+            #ifdef CLASH_DETECT_MCU
+                uint32_t jerk = clash_update(samples, n);
+                if (jerk) {
+                    TRACE(TRACE_IMU_CLASH, jerk);
+                    clash = jerk;
+                }
+            #endif
+            #ifdef SMOOTHSWING_ENABLE
+                smoothswing_mix_t mix;
+                smoothswing_update(samples, n, &mix);
+                spk_smoothswing(&mix);
+            #endif
+        }
+    #endif
+
+    return clash;
+}
@@ -0,0 +1,25 @@
+/**
+ * @file motion.h
+ * @brief Processing of the IMU samples
+ *
+ * Runs the samples streamed from the IMU FIFO through the clash detector
+ * and SmoothSwing, as far as they are enabled. With SYS_DUAL_CORE this is
+ * done on core 1, see cores.h.
+ */
+
+
+#ifndef MOTION_H
+#define MOTION_H
+
+
+#include <stdint.h>
+
+
+void motion_reset();                    // On turning on
+
+// Take every sample waiting. Returns the jerk of a clash detected in them,
+// see clash.h, or 0.
+uint32_t motion_process();
+
+
+#endif /* MOTION_H */
@@ -10,6 +10,9 @@
 
 // WS2812B LED strip
 #define PIN_LEDSTRIP            15
+// First of LEDSTRIP_N_STRANDS consecutive pins for parallel strands. 10 to 13
+// are free on this board.
+#define PIN_LEDSTRIP_STRANDS    10
 
 // PAM8302 audio amplifier PWM output
 #define PIN_SPK_PWM             9
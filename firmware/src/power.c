@@ -0,0 +1,42 @@
+/**
+ * @file power.c
+ * @brief LED strip current governor
+ */
+
+
+#include "config.h"
+#include "power.h"
+
+
+#define POWER_IDLE_MA       ((LEDSTRIP_IDLE_UA_PER_LED * N_LEDSTRIP_LEDS \
+                              * LEDSTRIP_N_STRANDS + 999) / 1000)
+
+#if LEDSTRIP_CURRENT_BUDGET_MA <= POWER_IDLE_MA
+    #error "LEDSTRIP_CURRENT_BUDGET_MA must be above the idle current of the strip"
+#endif
+
+
+uint32_t power_limit(led_color_t* duty, uint32_t n, uint32_t* requested_ma) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sum += (uint32_t) duty[i].g + duty[i].r + duty[i].b;
+    }
+
+    // Every strand shows the frame
+    uint32_t lit_ma = (uint32_t) (((uint64_t) sum * LEDSTRIP_MA_PER_CHANNEL
+                                   * LEDSTRIP_N_STRANDS) / 65535);
+    uint32_t ma = POWER_IDLE_MA + lit_ma;
+    *requested_ma = ma;
+    if (ma <= LEDSTRIP_CURRENT_BUDGET_MA)
+        return ma;
+
+    // Q16, below 1
+    uint32_t scale = (uint32_t) (((uint64_t) (LEDSTRIP_CURRENT_BUDGET_MA - POWER_IDLE_MA)
+                                  << 16) / lit_ma);
+    for (uint32_t i = 0; i < n; i++) {
+        duty[i].g = (uint16_t) ((duty[i].g * scale) >> 16);
+        duty[i].r = (uint16_t) ((duty[i].r * scale) >> 16);
+        duty[i].b = (uint16_t) ((duty[i].b * scale) >> 16);
+    }
+    return POWER_IDLE_MA + (uint32_t) (((uint64_t) lit_ma * scale) >> 16);
+}
@@ -0,0 +1,28 @@
+/**
+ * @file power.h
+ * @brief LED strip current governor
+ *
+ * The boost converter browns out on a bright blade, resetting the IMU. Each
+ * frame's current is estimated from its duty, LEDSTRIP_MA_PER_CHANNEL per
+ * channel at full duty plus LEDSTRIP_IDLE_UA_PER_LED per LED, over all
+ * strands, and a frame estimated above LEDSTRIP_CURRENT_BUDGET_MA is dimmed
+ * evenly to fit it.
+ */
+
+
+#ifndef POWER_H
+#define POWER_H
+
+
+#include <stdint.h>
+
+#include "ledstrip.h"
+
+
+// Estimate the current of a frame of n LEDs of duty, and dim it in place
+// if over budget. Returns the estimate after dimming, what the strip draws,
+// and gives the one before in requested_ma, both in mA.
+uint32_t power_limit(led_color_t* duty, uint32_t n, uint32_t* requested_ma);
+
+
+#endif /* POWER_H */
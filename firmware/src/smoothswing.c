@@ -0,0 +1,99 @@
+/**
+ * @file smoothswing.c
+ * @brief Continuous swing sounds from the gyro
+ */
+
+
+#include "config.h"
+#include "mixer.h"
+#include "utilities.h"
+#include "smoothswing.h"
+
+
+#ifdef SMOOTHSWING_ENABLE
+
+#ifndef IMU_FIFO_MODE
+    #error "SMOOTHSWING_ENABLE needs IMU_FIFO_MODE for the gyro samples"
+#endif
+
+// Gyro LSB per dps at the full scale range in use, Q8
+#define SS_LSB_PER_DPS_Q8   ((32768u * 256) / (250u << IMU_FIFO_GYRO_FS_SEL))
+
+#define SS_THRESHOLD        ((SMOOTHSWING_THRESHOLD_DPS * SS_LSB_PER_DPS_Q8) >> 8)
+#define SS_SENSITIVITY      ((SMOOTHSWING_SENSITIVITY_DPS * SS_LSB_PER_DPS_Q8) >> 8)
+
+// Angular speeds in LSB summed over the samples of one crossfade
+#define SS_TRANSITION       ((uint32_t) (((uint64_t) SMOOTHSWING_TRANSITION_DEG \
+                                * SS_LSB_PER_DPS_Q8 * IMU_FIFO_ODR_HZ) >> 8))
+
+#if SS_SENSITIVITY <= SS_THRESHOLD
+    #error "SMOOTHSWING_SENSITIVITY_DPS must be above SMOOTHSWING_THRESHOLD_DPS"
+#endif
+
+
+static int32_t speed_q4;                // Low passed angular speed, LSB Q4
+static uint32_t angle;                  // Into the current crossfade
+static uint8_t fading_in;               // Loop getting louder, 0 or 1
+
+
+void smoothswing_reset() {
+    speed_q4 = 0;
+    angle = 0;
+    fading_in = 1;
+}
+
+
+// Magnitude of the rotation vector. The squares of three int16 fit in 32 bits.
+static uint32_t __speed(const imu_sample_t* s) {
+    uint32_t sq = 0;
+    for (uint8_t k = 0; k < 3; k++) {
+        int32_t g = s->gyro[k];
+        sq += (uint32_t) (g * g);
+    }
+    return isqrt32(sq);
+}
+
+
+void smoothswing_update(const imu_sample_t* samples, uint32_t n,
+                        smoothswing_mix_t* mix) {
+    mix->reload = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t speed = (int32_t) __speed(&samples[i]);
+        speed_q4 += ((speed << 4) - speed_q4) >> SMOOTHSWING_SMOOTH_SHIFT;
+
+        // The crossfade moves with the angle turned, so it stands still
+        // while the blade does
+        angle += (uint32_t) speed_q4 >> 4;
+        if (angle >= SS_TRANSITION) {
+            angle -= SS_TRANSITION;
+            if (angle >= SS_TRANSITION)
+                angle = 0;
+            mix->reload |= 1u << (fading_in ^ 1);
+            fading_in ^= 1;
+        }
+    }
+
+    // Swing strength, Q8
+    uint32_t speed = (uint32_t) speed_q4 >> 4;
+    uint32_t strength = 0;
+    if (speed >= SS_SENSITIVITY)
+        strength = 256;
+    else if (speed > SS_THRESHOLD)
+        strength = ((speed - SS_THRESHOLD) << 8) / (SS_SENSITIVITY - SS_THRESHOLD);
+
+    // Quadratic, so that slow moves stay quiet
+    uint32_t swing = (SPK_GAIN_SWING * ((strength * strength) >> 8)) >> 8;
+
+    // Equal power crossfade: the square roots of x and 1 - x, Q8
+    uint32_t x = (angle << 8) / SS_TRANSITION;
+    uint32_t in = isqrt32(x << 8);
+    uint32_t out = isqrt32((256 - x) << 8);
+    mix->swing_gain[fading_in] = (swing * in) >> 8;
+    mix->swing_gain[fading_in ^ 1] = (swing * out) >> 8;
+
+    mix->hum_gain = (SPK_GAIN_HUM * (256 - ((strength * SMOOTHSWING_HUM_DUCK) >> 8))) >> 8;
+    mix->hum_rate = MIXER_RATE_UNITY + ((strength * SMOOTHSWING_PITCH_BEND) >> 8);
+}
+
+#endif /* SMOOTHSWING_ENABLE */
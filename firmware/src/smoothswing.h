@@ -0,0 +1,40 @@
+/**
+ * @file smoothswing.h
+ * @brief Continuous swing sounds from the gyro
+ *
+ * SmoothSwing-style swing sounds: instead of one swing sound per detected
+ * swing, two looped swing sounds play all along under the hum at a volume
+ * following the angular speed of the blade. As the blade turns, one loop
+ * fades into the other; once faded out, a loop is swapped for another swing
+ * sound of the font, so the result doesn't repeat. The hum is ducked and
+ * bent up in pitch as the swing gets louder.
+ *
+ * Runs on the gyro samples from the IMU FIFO, in fixed point. The work per
+ * sample is a few multiplications and an integer square root.
+ */
+
+
+#ifndef SMOOTHSWING_H
+#define SMOOTHSWING_H
+
+
+#include <stdint.h>
+
+#include "imu.h"
+
+
+// What to play, for the speaker to apply
+typedef struct {
+    uint16_t hum_gain;                  // Q8
+    uint16_t swing_gain[2];             // Q8, loops A and B
+    uint32_t hum_rate;                  // Q16, see MIXER_RATE_UNITY
+    uint8_t reload;                     // Bit n: loop n faded out, swap it
+} smoothswing_mix_t;
+
+
+void smoothswing_reset();
+void smoothswing_update(const imu_sample_t* samples, uint32_t n,
+                        smoothswing_mix_t* mix);
+
+
+#endif /* SMOOTHSWING_H */
@@ -4,274 +4,402 @@
  */
 
 
-#include "pico/stdlib.h"
-#include "hardware/pwm.h"
-#include "hardware/dma.h"
-#include "hardware/sync.h"
-
+#include "hal.h"
 #include "speaker.h"
 #include "config.h"
 #include "pinmap.h"
 #include "utilities.h"
+#include "mixer.h"
+#include "font.h"
+#include "trace.h"
+#include "events.h"
+#include "cores.h"
+
 
-// Select which tunes file to include
-#ifdef TUNES_USE_EP4
-    #include "tunes_ep4_44k1.h"
-#elif defined(TUNES_USE_OBS)
-    #include "tunes_obs_44k1.h"
-#elif defined(TUNES_USE_CLASSIC)
-    #include "tunes_classic_44k1.h"
-#elif defined(TUNES_USE_OBS_CLASSICPWR)
-    #include "tunes_obs_classicpower_44k1.h"
-#else
-    #include "tunes_obs_originalpower_44k1.h"
+volatile bool done_playing = true;
+
+volatile bool playing_poweron = false;
+
+// Ping-pong buffers of PWM compare values, each holding one mixer block with
+// every sample repeated SPK_N_REPETITIONS times
+#define SPK_BUFFER_LEN  (SPK_BLOCK_SIZE * SPK_N_REPETITIONS)
+
+// A block of full scale squares, 2^22 each, must stay below 2^32
+#if SPK_BLOCK_SIZE >= 1024
+    #error "SPK_BLOCK_SIZE is too large for the envelope sums"
 #endif
 
+static uint16_t spk_buffer[2][SPK_BUFFER_LEN];
+static int16_t mix_block[SPK_BLOCK_SIZE];
 
-volatile bool play_repeat = false;
-volatile bool done_playing = false;
+// 16-bit samples to PWM levels centered on SPK_PWM_MID
+#define SPK_PWM_SHIFT   (16 - SPK_PWM_BITS)
+#define SPK_PWM_MID     (1 << (SPK_PWM_BITS - 1))
+#define SPK_PWM_LSB     (1 << SPK_PWM_SHIFT)
 
-volatile bool playing_poweron = false;
+#ifdef SPK_NOISE_SHAPING
+// Rounding error carried to the next level, and the dither generator
+static int32_t shape_err = 0;
+static uint32_t shape_rand = 0x2545f491;
+#endif
+
+// Whether the buffers are being played out, and for how many blocks the mixer
+// has been idle so that the last block with audio can drain before stopping
+static volatile bool streaming = false;
+static volatile uint8_t idle_blocks = 0;
+
+// Hum gain before ducking, lowered by SmoothSwing
+static volatile uint16_t hum_gain = SPK_GAIN_HUM;
+
+// Envelope of the output, see spk_envelope()
+static volatile uint16_t envelope = 0;
+
+#ifdef SMOOTHSWING_ENABLE
+// Swing sound looped on each SmoothSwing voice
+static uint8_t smooth_idx[2];
+#endif
+
+#ifdef TRACE_ENABLE
+// Voices started since the last fill, and the ones mixed into the half that
+// starts playing on the next audio interrupt
+static volatile uint8_t trace_started = 0;
+static uint8_t trace_queued = 0;
+#endif
+
+
+// PWM level of a mixed sample. Noise shaped, each repetition of a sample gets
+// its own level, so that the error is spread over the repetitions too.
+static inline uint16_t __pwm_level(int32_t s) {
+    #ifdef SPK_NOISE_SHAPING
+        s += shape_err;
+
+        // Triangular dither of +-1 level from two halves of one xorshift
+        shape_rand ^= shape_rand << 13;
+        shape_rand ^= shape_rand >> 17;
+        shape_rand ^= shape_rand << 5;
+        int32_t d = (int32_t) (shape_rand & (SPK_PWM_LSB - 1))
+                    + (int32_t) ((shape_rand >> 16) & (SPK_PWM_LSB - 1))
+                    - (SPK_PWM_LSB - 1);
+
+        // Clipped, the error is dropped rather than wound up
+        int32_t level = ((s + d) >> SPK_PWM_SHIFT) + SPK_PWM_MID;
+        if (level < 0) {
+            shape_err = 0;
+            return 0;
+        }
+        if (level > SPK_PWM_COUNT_TOP) {
+            shape_err = 0;
+            return SPK_PWM_COUNT_TOP;
+        }
+        shape_err = s - (level - SPK_PWM_MID) * SPK_PWM_LSB;
+        return (uint16_t) level;
+    #else
+        return (uint16_t) ((s >> SPK_PWM_SHIFT) + SPK_PWM_MID);
+    #endif
+}
 
-// The audio buffer
-static const uint8_t* audio_buffer;
-static uint32_t audio_buffer_size;
-
-// The DMA sample data (4x audio samples = bytes) and its address
-static uint32_t dma_sample = 0;
-static uint32_t* dma_sample_addr = &dma_sample;
-
-// 3 DMA channels
-//  - PWM channel: writes the sample data to the PWM. Chained to stream channel.
-//  - Trigger channel: triggers the PWM channel.
-//  - Stream channel: copies 1 byte of audio sample to the fixed DMA sample address.
-static int dma_pwm_chan;
-static int dma_trig_chan;
-static int dma_stream_chan;
-static dma_channel_config dma_pwm_cfg;
-static dma_channel_config dma_trig_cfg;
-static dma_channel_config dma_stream_cfg;
-
-
-void dma_irq_handler() {
-
-    // To play once, just don't retrigger the trigger channel
-    if (play_repeat) {
-        dma_hw->abort = 1u << dma_trig_chan;
-        dma_hw->ch[dma_stream_chan].al1_read_addr = (io_rw_32) audio_buffer;
-        dma_hw->ch[dma_trig_chan].al3_read_addr_trig = (io_rw_32) &dma_sample_addr;
+
+// Mix one block and convert it to PWM compare values
+static void __fill_buffer(uint16_t* buf) {
+    // Duck the hum under motion sounds
+    uint16_t gain = hum_gain;
+    if ((mixer_is_active(SPK_VOICE_SWING) || mixer_is_active(SPK_VOICE_CLASH))
+        && (gain > SPK_GAIN_HUM_DUCKED))
+        gain = SPK_GAIN_HUM_DUCKED;
+    mixer_set_gain(SPK_VOICE_HUM, gain);
+
+    mixer_fill(mix_block, SPK_BLOCK_SIZE);
+
+    // Squares of the samples to 12 bits, so that a block of them fits. Not
+    // needed when the envelope comes from the tracks.
+    uint32_t sq = 0;
+    for (uint32_t i = 0; i < SPK_BLOCK_SIZE; i++) {
+        int32_t s = mix_block[i];
+        for (uint32_t r = 0; r < SPK_N_REPETITIONS; r++) {
+            *buf++ = __pwm_level(s);
+        }
+        #ifndef SPK_ENV_FROM_TRACKS
+            s >>= 4;
+            sq += (uint32_t) (s * s);
+        #endif
     }
+
+    #ifndef SPK_ENV_FROM_TRACKS
+        // Follow the RMS of the block: quick to rise, slower to fall
+        uint32_t rms = isqrt32(sq / SPK_BLOCK_SIZE) << 4;
+        uint32_t env = envelope;
+        if (rms > env)
+            env += (rms - env) >> SPK_ENV_ATTACK_SHIFT;
+        else
+            env -= (env - rms) >> SPK_ENV_RELEASE_SHIFT;
+        envelope = (uint16_t) env;
+    #else
+        (void) sq;
+    #endif
+}
+
+
+// Called from the audio interrupt once a half-buffer has been played out
+static void __audio_handler(uint8_t half) {
+    #ifdef TRACE_ENABLE
+        // The half filled last time has just started playing
+        if (trace_queued)
+            TRACE(TRACE_SPK_AUDIBLE, trace_queued);
+        trace_queued = trace_started;
+        trace_started = 0;
+    #endif
+
     // If just finished playing power on, go right to hum
-    else if (playing_poweron) {
-        dma_hw->abort = 1u << dma_trig_chan;
+    if (playing_poweron && !mixer_is_active(SPK_VOICE_POWER)) {
         playing_poweron = false;
-
-        audio_buffer = TUNE_HUM_DATA;
-        audio_buffer_size = TUNE_HUM_LEN;
-        play_repeat = true;
-        dma_hw->ch[dma_trig_chan].transfer_count = SPK_N_REPETITIONS * audio_buffer_size;
-        dma_hw->ch[dma_stream_chan].al1_read_addr = (io_rw_32) audio_buffer;
-        dma_hw->ch[dma_trig_chan].al3_read_addr_trig = (io_rw_32) &dma_sample_addr;
+        spk_play_hum_repeat();
     }
-    else {
-        spk_disable();
-        done_playing = true;
+
+    // Stop once every voice has ended and the last block with audio, now
+    // playing from the other half, has been played
+    if (mixer_is_idle()) {
+        idle_blocks++;
+        if (idle_blocks > 1) {
+            streaming = false;
+            envelope = 0;
+            hal_audio_stop();
+            spk_disable();
+            done_playing = true;
+            events_post(EVENT_SPK_DONE, 0);
+            return;
+        }
+    } else {
+        idle_blocks = 0;
     }
 
-    // Acknowledge the interrupt
-    dma_hw->ints0 = 1u << dma_trig_chan;
+    __fill_buffer(spk_buffer[half]);
 }
 
 
 void spk_init() {
     playing_poweron = false;
+    streaming = false;
+    done_playing = true;
+    hum_gain = SPK_GAIN_HUM;
+
+    mixer_init();
 
     // Disable the speaker on startup
-    gpio_init(PIN_SPK_EN);
-    gpio_set_dir(PIN_SPK_EN, GPIO_OUT);
-    
+    hal_gpio_init(PIN_SPK_EN, true);
     spk_disable();
 
-    // Get PWM slice and set up PWM
-    gpio_set_function(PIN_SPK_PWM, GPIO_FUNC_PWM);
-    pwm_set_gpio_level(PIN_SPK_PWM, 0);
-
-    int spk_pwm_slice = pwm_gpio_to_slice_num(PIN_SPK_PWM);
-    pwm_config pwm_cfg = pwm_get_default_config();
-    pwm_config_set_clkdiv(&pwm_cfg, SPK_PWM_CLKDIV);
-    // Since data is 8-bit, counter top should be 8-bit top
-    pwm_config_set_wrap(&pwm_cfg, SPK_PWM_COUNT_TOP);
-    pwm_init(spk_pwm_slice, &pwm_cfg, true);
-
-    // Set up DMA for playing the turnon sound by default
-    audio_buffer = TUNE_POWERON_DATA;
-    audio_buffer_size = TUNE_POWERON_LEN;
-
-    dma_pwm_chan = dma_claim_unused_channel(true);
-    dma_trig_chan = dma_claim_unused_channel(true);
-    dma_stream_chan = dma_claim_unused_channel(true);
-
-    dma_pwm_cfg = dma_channel_get_default_config(dma_pwm_chan);
-    // Transfer 16 bytes to repeat the sample on both upper and lower halves of CC
-    channel_config_set_transfer_data_size(&dma_pwm_cfg, DMA_SIZE_16);
-    channel_config_set_read_increment(&dma_pwm_cfg, false);
-    channel_config_set_write_increment(&dma_pwm_cfg, false);
-    // Chain to stream DMA channel when done
-    channel_config_set_chain_to(&dma_pwm_cfg, dma_stream_chan);
-    // Transfer on PWM DREQ
-    channel_config_set_dreq(&dma_pwm_cfg, DREQ_PWM_WRAP0 + spk_pwm_slice);
-
-    dma_channel_configure(
-        dma_pwm_chan,
-        &dma_pwm_cfg,
-        &pwm_hw->slice[spk_pwm_slice].cc,     // Write to PWM slice CC register
-        &dma_sample,
-        SPK_N_REPETITIONS,                          // Do N_REPETITIONS transfers
-        false                                   // Do not start yet 
-    );
-
-    dma_trig_cfg = dma_channel_get_default_config(dma_trig_chan);
-    channel_config_set_transfer_data_size(&dma_trig_cfg, DMA_SIZE_32);
-    channel_config_set_read_increment(&dma_trig_cfg, false);
-    channel_config_set_write_increment(&dma_trig_cfg, false);
-    // Transfer on PWM cycle end
-    channel_config_set_dreq(&dma_trig_cfg, DREQ_PWM_WRAP0 + spk_pwm_slice);
-
-    dma_channel_configure(
-        dma_trig_chan,
-        &dma_trig_cfg,
-        // Write to PWM DMA channel read address trigger
-        &dma_hw->ch[dma_pwm_chan].al3_read_addr_trig,
-        // Read from our address
-        &dma_sample_addr,
-        // Trigger once for each repetition * number of audio bytes
-        SPK_N_REPETITIONS * audio_buffer_size,
-        false                                   // Do not start yet 
-    );
-
-    // Interrupt when trigger channel is done
-    dma_channel_set_irq0_enabled(dma_trig_chan, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
-
-    dma_stream_cfg = dma_channel_get_default_config(dma_stream_chan);
-    channel_config_set_transfer_data_size(&dma_stream_cfg, DMA_SIZE_8);
-    channel_config_set_read_increment(&dma_stream_cfg, true);
-    channel_config_set_write_increment(&dma_stream_cfg, false);
-
-    dma_channel_configure(
-        dma_stream_chan,
-        &dma_stream_cfg,
-        // Write to our sample address
-        &dma_sample,
-        // Read from the audio array
-        audio_buffer,
-        // Do one transfer per PWM completion
-        1,
-        false                                   // Do not start yet 
-    );
+    hal_audio_init(spk_buffer[0], spk_buffer[1], SPK_BUFFER_LEN, __audio_handler);
 }
 
 
-void spk_play(bool repeat) {
-    play_repeat = repeat;
+// Start playing out the ping-pong buffers if not already doing so. Voices are
+// picked up by the mixer on the next block.
+static void __start_stream() {
     done_playing = false;
-
-    // Stop whatever is currently playing
-    dma_channel_abort(dma_trig_chan);
-
-    // Reconfigure everything that needs to be reconfigured
-    // with a new audio buffer
-    dma_channel_configure(
-        dma_trig_chan,
-        &dma_trig_cfg,
-        // Write to PWM DMA channel read address trigger
-        &dma_hw->ch[dma_pwm_chan].al3_read_addr_trig,
-        // Read from our address
-        &dma_sample_addr,
-        // Trigger once for each repetition * number of audio bytes
-        SPK_N_REPETITIONS * audio_buffer_size,
-        false                                   // Do not start yet 
-    );
-
-    dma_channel_configure(
-        dma_stream_chan,
-        &dma_stream_cfg,
-        // Write to our sample address
-        &dma_sample,
-        // Read from the audio array
-        audio_buffer,
-        // Do one transfer per PWM completion
-        1,
-        false                                   // Do not start yet 
-    );
-
-    // Hit it
-    dma_channel_start(dma_trig_chan);
-    gpio_put(PIN_SPK_EN, 1);
+    idle_blocks = 0;
+
+    if (!streaming) {
+        streaming = true;
+        __fill_buffer(spk_buffer[0]);
+        __fill_buffer(spk_buffer[1]);
+        hal_audio_start();
+
+        #ifdef TRACE_ENABLE
+            TRACE(TRACE_SPK_START, 0);
+            if (trace_started)
+                TRACE(TRACE_SPK_AUDIBLE, trace_started);
+            trace_started = 0;
+            trace_queued = 0;
+        #endif
+    }
+    spk_enable();
 }
 
 
+// Note a voice about to be handed to the mixer, to trace when it is heard
+static inline void __trace_play(uint8_t voice) {
+    #ifdef TRACE_ENABLE
+        uint32_t status = hal_irq_disable();
+        trace_started |= (1u << voice);
+        hal_irq_restore(status);
+        TRACE(TRACE_SPK_PLAY, voice);
+    #endif
+}
+
 
 inline void spk_play_turnon() {
-    audio_buffer = TUNE_POWERON_DATA;
-    audio_buffer_size = TUNE_POWERON_LEN;
+    if (cores_call(CORES_MSG_SPK, SPK_CMD_TURNON))
+        return;
+
+    const font_t* font = font_get();
+    if (font == NULL)
+        return;
+
     playing_poweron = true;
-    spk_play(false);
+    mixer_play(SPK_VOICE_POWER, &font->poweron, SPK_GAIN_POWER, false);
+    __start_stream();
 }
 
 inline void spk_play_turnoff() {
-    audio_buffer = TUNE_POWEROFF_DATA;
-    audio_buffer_size = TUNE_POWEROFF_LEN;
-    spk_play(false);
+    if (cores_call(CORES_MSG_SPK, SPK_CMD_TURNOFF))
+        return;
+
+    const font_t* font = font_get();
+    if (font == NULL)
+        return;
+
+    playing_poweron = false;
+    mixer_stop(SPK_VOICE_HUM);
+    #ifdef SMOOTHSWING_ENABLE
+        mixer_stop(SPK_VOICE_SMOOTH_A);
+        mixer_stop(SPK_VOICE_SMOOTH_B);
+    #endif
+    mixer_play(SPK_VOICE_POWER, &font->poweroff, SPK_GAIN_POWER, false);
+    __start_stream();
 }
 
 inline void spk_play_hum_repeat() {
-    audio_buffer = TUNE_HUM_DATA;
-    audio_buffer_size = TUNE_HUM_LEN;
-    spk_play(true);
+    if (cores_call(CORES_MSG_SPK, SPK_CMD_HUM))
+        return;
+
+    const font_t* font = font_get();
+    if (font == NULL)
+        return;
+
+    hum_gain = SPK_GAIN_HUM;
+    mixer_play(SPK_VOICE_HUM, &font->hum, SPK_GAIN_HUM, true);
+
+    // The SmoothSwing loops start silent along with the hum
+    #ifdef SMOOTHSWING_ENABLE
+        if (font->n_swing > 0) {
+            smooth_idx[0] = 0;
+            smooth_idx[1] = 1 % font->n_swing;
+            mixer_play(SPK_VOICE_SMOOTH_A, &font->swing[smooth_idx[0]], 0, true);
+            mixer_play(SPK_VOICE_SMOOTH_B, &font->swing[smooth_idx[1]], 0, true);
+        }
+    #endif
+    __start_stream();
 }
 
 inline void spk_play_clash() {
-    // Pick a random clash sound out of the TUNE_CLASH_COUNT available
+    if (cores_call(CORES_MSG_SPK, SPK_CMD_CLASH))
+        return;
+
+    const font_t* font = font_get();
+    if ((font == NULL) || (font->n_clash == 0))
+        return;
+
+    // Pick a random clash sound out of the n_clash available
     // Since the ROSC is easiest to generate perfect square ranges, we'll
     // take the modulo, though it messes with uniformness
-    uint8_t i = rand_powof2(8) % TUNES_CLASH_COUNT;
-    audio_buffer = TUNES_CLASH_DATA[i];
-    audio_buffer_size = TUNES_CLASH_LENS[i];
-    spk_play(false);
+    uint8_t i = rand_powof2(8) % font->n_clash;
+    __trace_play(SPK_VOICE_CLASH);
+    mixer_play(SPK_VOICE_CLASH, &font->clash[i], SPK_GAIN_CLASH, false);
+    // A clash cuts off any swing still playing
+    mixer_stop(SPK_VOICE_SWING);
+    __start_stream();
 }
 
 inline void spk_play_swing() {
-    uint8_t i = rand_powof2(8) % TUNES_SWING_COUNT;
-    audio_buffer = TUNES_SWING_DATA[i];
-    audio_buffer_size = TUNES_SWING_LENS[i];
-    spk_play(false);
+    if (cores_call(CORES_MSG_SPK, SPK_CMD_SWING))
+        return;
+
+    const font_t* font = font_get();
+    if ((font == NULL) || (font->n_swing == 0))
+        return;
+
+    uint8_t i = rand_powof2(8) % font->n_swing;
+    __trace_play(SPK_VOICE_SWING);
+    mixer_play(SPK_VOICE_SWING, &font->swing[i], SPK_GAIN_SWING, false);
+    __start_stream();
+}
+
+
+void spk_command(uint8_t cmd) {
+    switch (cmd) {
+        case SPK_CMD_TURNON: spk_play_turnon(); break;
+        case SPK_CMD_TURNOFF: spk_play_turnoff(); break;
+        case SPK_CMD_HUM: spk_play_hum_repeat(); break;
+        case SPK_CMD_CLASH: spk_play_clash(); break;
+        case SPK_CMD_SWING: spk_play_swing(); break;
+        case SPK_CMD_STOP: spk_stop(); break;
+        default: break;
+    }
+}
+
+
+// Apply the SmoothSwing gains and hum pitch, while the hum plays
+void spk_smoothswing(const smoothswing_mix_t* mix) {
+    #ifdef SMOOTHSWING_ENABLE
+        const font_t* font = font_get();
+        if ((font == NULL) || (font->n_swing == 0) || !mixer_is_active(SPK_VOICE_HUM))
+            return;
+
+        hum_gain = mix->hum_gain;
+        mixer_set_rate(SPK_VOICE_HUM, mix->hum_rate);
+
+        for (uint8_t k = 0; k < 2; k++) {
+            uint8_t voice = SPK_VOICE_SMOOTH_A + k;
+
+            // Swap a faded out loop for another swing sound than the one
+            // still playing
+            if ((mix->reload & (1u << k)) && (font->n_swing > 2)) {
+                uint8_t i = rand_powof2(8) % (font->n_swing - 1);
+                if (i >= smooth_idx[k ^ 1])
+                    i++;
+                smooth_idx[k] = i;
+                mixer_play(voice, &font->swing[i], 0, true);
+            }
+            mixer_set_gain(voice, mix->swing_gain[k]);
+        }
+    #else
+        (void) mix;
+    #endif
 }
 
 
 inline void spk_stop() {
+    if (cores_call(CORES_MSG_SPK, SPK_CMD_STOP))
+        return;
+
     // Stop whatever is currently playing
-    play_repeat = false;    // Needed to stop the irq_handler from retriggering
-    dma_channel_abort(dma_trig_chan);
+    playing_poweron = false;
+    mixer_stop_all();
+    streaming = false;
+    envelope = 0;
+    hal_audio_stop();
     done_playing = true;
     spk_disable();
 }
 
 inline void spk_enable() {
-    gpio_put(PIN_SPK_EN, 1);
+    hal_gpio_put(PIN_SPK_EN, 1);
 }
 
 inline void spk_disable() {
-    gpio_put(PIN_SPK_EN, 0);
+    hal_gpio_put(PIN_SPK_EN, 0);
 }
 
 inline bool spk_is_done_playing() {
     return done_playing;
 }
 
-inline void spk_wait_until_done_playing() {
-    while (!done_playing) {
-        tight_loop_contents();
+
+// Safe to read from either core, a block stale at worst
+bool spk_is_only_humming() {
+    for (uint8_t v = 0; v < MIXER_N_VOICES; v++) {
+        if ((v != SPK_VOICE_HUM) && mixer_is_active(v))
+            return false;
     }
+    return true;
+}
+
+
+// Safe to read from either core
+uint16_t spk_envelope() {
+    #ifdef SPK_ENV_FROM_TRACKS
+        return streaming ? mixer_track_envelope() : 0;
+    #else
+        return envelope;
+    #endif
 }
@@ -8,21 +8,52 @@
 #define SPEAKER_H
 
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "smoothswing.h"
+
+// Mixer voice assignment
+#define SPK_VOICE_POWER         0
+#define SPK_VOICE_HUM           1
+#define SPK_VOICE_SWING         2
+#define SPK_VOICE_CLASH         3
+#define SPK_VOICE_SMOOTH_A      4       // SmoothSwing loops
+#define SPK_VOICE_SMOOTH_B      5
+
+
+// Calls made from core 0 with SYS_DUAL_CORE are carried out by core 1, which
+// owns the mixer, as one of these commands
+#define SPK_CMD_TURNON          0
+#define SPK_CMD_TURNOFF         1
+#define SPK_CMD_HUM             2
+#define SPK_CMD_CLASH           3
+#define SPK_CMD_SWING           4
+#define SPK_CMD_STOP            5
+
+
 void spk_init();
-void spk_play(bool repeat);
+void spk_command(uint8_t cmd);
 
 void spk_play_turnon();
 void spk_play_turnoff();
 void spk_play_hum_repeat();
 void spk_play_clash();
 void spk_play_swing();
+void spk_smoothswing(const smoothswing_mix_t* mix);
 
 void spk_stop();
 void spk_enable();
 void spk_disable();
 
 bool spk_is_done_playing();
-void spk_wait_until_done_playing();
+// No voice but the hum is mixed, SmoothSwing loops included
+bool spk_is_only_humming();
+
+// Envelope of the speaker output, full scale 32767: the RMS of each mixer
+// block, followed with SPK_ENV_ATTACK_SHIFT / SPK_ENV_RELEASE_SHIFT, or with
+// SPK_ENV_FROM_TRACKS looked up in the envelope tracks of the sounds playing
+uint16_t spk_envelope();
 
 
 #endif /* SPEAKER_H */
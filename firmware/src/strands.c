@@ -0,0 +1,66 @@
+/**
+ * @file strands.c
+ * @brief Bit plane frames for LED strands driven in parallel
+ */
+
+
+#include "hal.h"
+#include "strands.h"
+
+
+#if LEDSTRIP_N_STRANDS > 1
+
+// Transpose an 8x8 bit matrix: rows a[0..7], most significant bit first, to
+// columns in b[0..7] (Hacker's Delight, 7-3). 32-bit halves, as the M0+ has
+// no 64-bit shifts.
+static inline void __transpose8(const uint8_t a[8], uint8_t* b) {
+    uint32_t x = ((uint32_t) a[0] << 24) | ((uint32_t) a[1] << 16)
+               | ((uint32_t) a[2] << 8) | a[3];
+    uint32_t y = ((uint32_t) a[4] << 24) | ((uint32_t) a[5] << 16)
+               | ((uint32_t) a[6] << 8) | a[7];
+    uint32_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa;  x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00aa00aa;  y = y ^ t ^ (t << 7);
+
+    t = (x ^ (x >> 14)) & 0x0000cccc;  x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000cccc;  y = y ^ t ^ (t << 14);
+
+    t = (x & 0xf0f0f0f0) | ((y >> 4) & 0x0f0f0f0f);
+    y = ((x << 4) & 0xf0f0f0f0) | (y & 0x0f0f0f0f);
+    x = t;
+
+    b[0] = x >> 24;  b[1] = x >> 16;  b[2] = x >> 8;  b[3] = x;
+    b[4] = y >> 24;  b[5] = y >> 16;  b[6] = y >> 8;  b[7] = y;
+}
+
+
+void strands_transpose(const uint32_t pixels[][N_LEDSTRIP_LEDS],
+                       uint32_t* frame) {
+    uint8_t* planes = (uint8_t*) frame;
+
+    for (uint32_t i = 0; i < N_LEDSTRIP_LEDS; i++) {
+        // One color byte at a time: row 7 - n is strand n, so that column k,
+        // bit k of the bytes from the most significant, has strand n in bit n
+        for (int8_t shift = 16; shift >= 0; shift -= 8) {
+            uint8_t rows[8] = {0};
+            for (uint8_t n = 0; n < LEDSTRIP_N_STRANDS; n++) {
+                rows[7 - n] = (uint8_t) (pixels[n][i] >> shift);
+            }
+            __transpose8(rows, planes);
+            planes += 8;
+        }
+    }
+}
+
+#else
+
+// One strand: a word per pixel, as the ws2812 program takes it
+void strands_transpose(const uint32_t pixels[][N_LEDSTRIP_LEDS],
+                       uint32_t* frame) {
+    for (uint32_t i = 0; i < N_LEDSTRIP_LEDS; i++) {
+        frame[i] = HAL_LED_WORD(pixels[0][i]);
+    }
+}
+
+#endif /* LEDSTRIP_N_STRANDS > 1 */
@@ -0,0 +1,40 @@
+/**
+ * @file strands.h
+ * @brief Bit plane frames for LED strands driven in parallel
+ *
+ * With LEDSTRIP_N_STRANDS above 1, the strands are clocked out together by
+ * the ws2812_parallel PIO program, so a frame takes as long as one strand.
+ * It takes the frame as bit planes rather than pixels: for each LED, from the
+ * hilt, and each of its 24 GRB bits, most significant first, one byte with
+ * bit n the bit of strand n. The planes are sent in memory order.
+ */
+
+
+#ifndef STRANDS_H
+#define STRANDS_H
+
+
+#include <stdint.h>
+
+#include "config.h"
+
+
+#if (LEDSTRIP_N_STRANDS < 1) || (LEDSTRIP_N_STRANDS > 8)
+    #error "LEDSTRIP_N_STRANDS must be 1 to 8"
+#endif
+
+// 32-bit words in a frame, as sent to the HAL
+#if LEDSTRIP_N_STRANDS > 1
+    #define STRANDS_FRAME_WORDS     ((N_LEDSTRIP_LEDS * 24) / 4)
+#else
+    #define STRANDS_FRAME_WORDS     N_LEDSTRIP_LEDS
+#endif
+
+
+// Turn the GRB pixels of every strand, pixels[strand][led], into the planes
+// of a frame
+void strands_transpose(const uint32_t pixels[][N_LEDSTRIP_LEDS],
+                       uint32_t* frame);
+
+
+#endif /* STRANDS_H */
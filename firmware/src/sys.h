@@ -8,10 +8,6 @@
 #define SYS_H
 
 
-#include "pinmap.h"
-
-#define PIN_SYS_WAKEUP  PIN_BTN
-
 void sys_init();        // Set up clocks, etc.
 void sys_go_dormant();
 
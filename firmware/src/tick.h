@@ -7,10 +7,11 @@
 #define TICK_H
 
 
-#include "pico/stdlib.h"
-#include "hardware/structs/systick.h"
+#include <stdint.h>
+
 
 void tick_init();
+void tick_set_clock(uint32_t clk_khz);  // After the system clock changed
 
 // Define to overload the default Systick interrupt handler in the crt0.S file
 extern void isr_systick();
@@ -0,0 +1,93 @@
+/**
+ * @file trace.c
+ * @brief Timestamped event trace for latency measurements
+ */
+
+
+#include <stdio.h>
+
+#include "hal.h"
+#include "config.h"
+#include "trace.h"
+
+
+#ifdef TRACE_ENABLE
+
+typedef struct {
+    uint32_t t_us;
+    uint16_t event;
+    uint16_t arg;
+} trace_entry_t;
+
+
+static const char* const TRACE_NAMES[TRACE_N_EVENTS] = {
+    "IMU_INT",
+    "IMU_CLASH",
+    "IMU_SWING",
+    "MAIN_CLASH",
+    "MAIN_SWING",
+    "SPK_PLAY",
+    "SPK_START",
+    "SPK_AUDIBLE",
+    "LED_SHOW",
+    "LED_DONE",
+    "LED_LATE",
+    "LED_DROP",
+    "LED_LIMIT",
+    "BTN_SHORT",
+    "BTN_LONG",
+    "BTN_EXTRA_LONG",
+    "SYS_CLOCK",
+};
+
+
+// Oldest entries are overwritten once full
+static trace_entry_t trace_buf[TRACE_BUFFER_LEN];
+static volatile uint32_t trace_head = 0;
+static volatile uint32_t trace_count = 0;
+
+
+void trace_init() {
+    hal_console_init();
+    trace_head = 0;
+    trace_count = 0;
+}
+
+
+// Both cores record
+void trace_record(trace_event_t event, uint16_t arg) {
+    uint32_t status = hal_lock_cores();
+    trace_entry_t* e = &trace_buf[trace_head];
+    e->t_us = hal_time_us();
+    e->event = event;
+    e->arg = arg;
+    trace_head = (trace_head + 1) % TRACE_BUFFER_LEN;
+    trace_count++;
+    hal_unlock_cores(status);
+}
+
+
+// Print and empty the buffer. Slow, call when nothing is going on.
+void trace_dump() {
+    uint32_t status = hal_lock_cores();
+    uint32_t count = trace_count;
+    uint32_t head = trace_head;
+    trace_count = 0;
+    hal_unlock_cores(status);
+
+    uint32_t n = (count < TRACE_BUFFER_LEN) ? count : TRACE_BUFFER_LEN;
+    if (count > n)
+        printf("T,lost,%u\n", (unsigned) (count - n));
+
+    // Entries may be overwritten by new ones while printing; at worst those
+    // come out mixed up, which is fine for a debugging aid
+    uint32_t idx = (head + TRACE_BUFFER_LEN - n) % TRACE_BUFFER_LEN;
+    for (uint32_t i = 0; i < n; i++) {
+        const trace_entry_t* e = &trace_buf[idx];
+        printf("T,%u,%s,%u\n", (unsigned) e->t_us, TRACE_NAMES[e->event],
+               (unsigned) e->arg);
+        idx = (idx + 1) % TRACE_BUFFER_LEN;
+    }
+}
+
+#endif /* TRACE_ENABLE */
@@ -0,0 +1,57 @@
+/**
+ * @file trace.h
+ * @brief Timestamped event trace for latency measurements
+ *
+ * Probes record an event and a microsecond timestamp from the hardware timer
+ * into a ring buffer, from interrupts or the main loop alike. The buffer is
+ * dumped as text with trace_dump(), one `T,<t_us>,<event>,<arg>` line per
+ * event, over the UART or to stdout in the host build. `util/trace_latency.py`
+ * turns a dump into event-to-sound latency statistics.
+ *
+ * Everything compiles out unless TRACE_ENABLE is defined.
+ */
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include <stdint.h>
+
+
+typedef enum {
+    TRACE_IMU_INT,          // IMU interrupt handler entered
+    TRACE_IMU_CLASH,        // Handler flagged a clash
+    TRACE_IMU_SWING,        // Handler flagged a swing
+    TRACE_MAIN_CLASH,       // Main loop picked up the clash
+    TRACE_MAIN_SWING,       // Main loop picked up the swing
+    TRACE_SPK_PLAY,         // Voice (arg) handed to the mixer
+    TRACE_SPK_START,        // DMA triggered from idle
+    TRACE_SPK_AUDIBLE,      // First samples of voices (arg, mask) start playing
+    TRACE_LED_SHOW,         // LED frame handed to the DMA
+    TRACE_LED_DONE,         // LED frame out and latched by the strip
+    TRACE_LED_LATE,         // LED frame held up by the previous one (count)
+    TRACE_LED_DROP,         // LED frame replaced before being sent (count)
+    TRACE_LED_LIMIT,        // LED frame dimmed to the current budget (mA)
+    TRACE_BTN_SHORT,        // Button handler flagged a press
+    TRACE_BTN_LONG,
+    TRACE_BTN_EXTRA_LONG,
+    TRACE_SYS_CLOCK,        // System clock switched to a level (arg)
+    TRACE_N_EVENTS
+} trace_event_t;
+
+
+#ifdef TRACE_ENABLE
+    #define TRACE(event, arg)   trace_record((event), (arg))
+    #define TRACE_DUMP()        trace_dump()
+
+    void trace_init();
+    void trace_record(trace_event_t event, uint16_t arg);
+    void trace_dump();
+#else
+    #define TRACE(event, arg)   ((void) 0)
+    #define TRACE_DUMP()        ((void) 0)
+#endif
+
+
+#endif /* TRACE_H */
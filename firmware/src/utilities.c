@@ -5,13 +5,13 @@
 
 
 #include "utilities.h"
-#include "hardware/rosc.h"
+#include "hal.h"
 
 
 uint32_t rand_powof2(uint8_t n_bits) {
     uint32_t r = 0;
     for (int i = 0; i < n_bits; i++) {
-        uint32_t rb = (0x0001 & rosc_hw->randombit);
+        uint32_t rb = hal_rand_bit();
         r = (r << 1) | rb;
     }
     return r;
@@ -21,7 +21,7 @@ uint32_t rand_powof2(uint8_t n_bits) {
 uint32_t rand_powof2_range(uint8_t n_bits_min, uint8_t n_bits_max) {
     uint32_t r = 0;
     for (int i = 0; i < n_bits_max; i++) {
-        uint32_t rb = (0x0001 & rosc_hw->randombit);
+        uint32_t rb = hal_rand_bit();
         r = (r << 1) | rb;
     }
     while (r > n_bits_min) {
@@ -29,3 +29,25 @@ uint32_t rand_powof2_range(uint8_t n_bits_min, uint8_t n_bits_max) {
     }
     return r;
 }
+
+
+// Integer square root, rounded down. One bit of the result per iteration,
+// no multiplications.
+uint32_t isqrt32(uint32_t x) {
+    uint32_t r = 0;
+    uint32_t bit = 1u << 30;
+
+    while (bit > x) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
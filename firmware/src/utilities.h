@@ -12,5 +12,7 @@
 uint32_t rand_powof2(uint8_t n_bits);
 uint32_t rand_powof2_range(uint8_t n_bits_min, uint8_t n_bits_max);
 
+uint32_t isqrt32(uint32_t x);
+
 
 #endif // UTILITIES_H
\ No newline at end of file
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+
+"""
+Plans the system clock and speaker PWM divider for every audio format
+
+Usage: clockplan.py [--min-clock KHZ] [--idle-clock KHZ] [--boost-clock KHZ]
+                    [--tolerance PPM] [output.h]
+
+Notes:
+    - The speaker PWM wraps every 2^bits cycles, once per repetition of each
+      sample, so it must run at sample rate * repetitions * 2^bits. That has
+      to come out of the system clock, itself made by the PLL from the 12 MHz
+      crystal (VCO of 750 to 1600 MHz, then two post dividers of 1 to 7),
+      through the PWM divider (8 integer and 4 fractional bits).
+
+    - For each sample rate, PWM resolution and repetition count, this picks
+      the lowest system clock of at least --min-clock that plays within
+      --tolerance of the sample rate, then the lowest VCO giving it, as both
+      cost power. Formats whose carrier (sample rate * repetitions) would be
+      below --min-carrier, within earshot, get no plan.
+
+    - The same is planned from --idle-clock and --boost-clock, for the clock
+      governor to scale the clock down when the saber only hums and up for
+      heavy effects, at the same sample rate. See clocks.h.
+
+    - The output is a C header, src/clock_plan.h by default, included by
+      config.h. A format without a plan fails the build there, rather than
+      playing off pitch. Rerun this after changing the options; the header
+      records them, and config.h checks that they match its own.
+"""
+
+import argparse
+import os
+
+
+parser = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("output", nargs="?",
+                    default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                         "..", "src", "clock_plan.h"),
+                    help="Output header, src/clock_plan.h by default")
+parser.add_argument("--min-clock", type=int, default=27000,
+                    help="Lowest system clock, in kHz (SYS_CLK_MIN_KHZ)")
+parser.add_argument("--idle-clock", type=int, default=18000,
+                    help="Lowest idle system clock, in kHz (SYS_CLK_IDLE_MIN_KHZ)")
+parser.add_argument("--boost-clock", type=int, default=48000,
+                    help="Lowest boost system clock, in kHz (SYS_CLK_BOOST_MIN_KHZ)")
+parser.add_argument("--tolerance", type=int, default=2000,
+                    help="Largest sample rate error, in ppm (SPK_RATE_TOLERANCE_PPM)")
+parser.add_argument("--min-carrier", type=int, default=40000,
+                    help="Lowest PWM carrier, in Hz (SPK_PWM_CARRIER_MIN_HZ)")
+args = parser.parse_args()
+
+
+SAMPLE_RATES = [8000, 22050, 44100]
+PWM_BITS = [8, 10, 11]
+REPETITIONS = [1, 2, 4, 8]
+
+# RP2040 clocks, see the datasheet and the SDK's set_sys_clock_pll()
+XOSC_KHZ = 12000
+VCO_MIN_KHZ = 750000
+VCO_MAX_KHZ = 1600000
+FBDIV_MIN = 16
+FBDIV_MAX = 320
+POSTDIV_MAX = 7
+SYS_CLK_MAX_KHZ = 133000
+PWM_DIV_FRAC_BITS = 4
+PWM_DIV_MAX = 256 << PWM_DIV_FRAC_BITS
+
+
+# Every system clock the PLL makes exactly, with its VCO and post dividers,
+# lowest VCO first
+def pll_plans():
+    plans = []
+    for fbdiv in range(FBDIV_MIN, FBDIV_MAX + 1):
+        vco = XOSC_KHZ * fbdiv
+        if not VCO_MIN_KHZ <= vco <= VCO_MAX_KHZ:
+            continue
+        for pd1 in range(1, POSTDIV_MAX + 1):
+            for pd2 in range(1, pd1 + 1):
+                if (vco % (pd1 * pd2) == 0) and (vco // (pd1 * pd2) <= SYS_CLK_MAX_KHZ):
+                    plans.append((vco // (pd1 * pd2), vco, pd1, pd2))
+    return sorted(plans, key=lambda p: (p[0], p[1]))
+
+
+# The plan for one format from a lowest system clock, or None
+def plan(rate, bits, reps, plls, min_clock):
+    if rate * reps < args.min_carrier:
+        return None
+
+    wrap_hz = rate * reps * (1 << bits)
+    for sys_khz, vco, pd1, pd2 in plls:
+        if sys_khz < min_clock:
+            continue
+        # Nearest divider, in 1/16ths
+        div = round(sys_khz * 1000 * (1 << PWM_DIV_FRAC_BITS) / wrap_hz)
+        if not (1 << PWM_DIV_FRAC_BITS) <= div < PWM_DIV_MAX:
+            continue
+        actual = sys_khz * 1000 * (1 << PWM_DIV_FRAC_BITS) / (div * reps * (1 << bits))
+        ppm = (actual - rate) / rate * 1e6
+        if abs(ppm) <= args.tolerance:
+            return sys_khz, vco, pd1, pd2, div, ppm
+    return None
+
+
+plls = pll_plans()
+
+with open(args.output, "w") as of:
+    of.write("/**\n")
+    of.write(" * @file clock_plan.h\n")
+    of.write(" * @brief System clock and speaker PWM divider for each audio format\n")
+    of.write(" *\n")
+    of.write(" * Generated by util/clockplan.py, do not edit. Included by config.h.\n")
+    of.write(" */\n\n\n")
+    of.write("#ifndef CLOCK_PLAN_H\n#define CLOCK_PLAN_H\n\n\n")
+
+    of.write("// Options the plans were made with\n")
+    of.write("#define CLOCK_PLAN_MIN_KHZ          %d\n" % args.min_clock)
+    of.write("#define CLOCK_PLAN_IDLE_KHZ         %d\n" % args.idle_clock)
+    of.write("#define CLOCK_PLAN_BOOST_KHZ        %d\n" % args.boost_clock)
+    of.write("#define CLOCK_PLAN_TOLERANCE_PPM    %d\n" % args.tolerance)
+    of.write("#define CLOCK_PLAN_MIN_CARRIER_HZ   %d\n\n" % args.min_carrier)
+
+    # One branch per format that has a plan
+    first = True
+    for rate in SAMPLE_RATES:
+        for bits in PWM_BITS:
+            for reps in REPETITIONS:
+                p = plan(rate, bits, reps, plls, args.min_clock)
+                if p is None:
+                    continue
+                # A level without a plan of its own runs at the normal clock
+                idle = plan(rate, bits, reps, plls, args.idle_clock) or p
+                boost = plan(rate, bits, reps, plls, args.boost_clock) or p
+                sys_khz, vco, pd1, pd2, div, ppm = p
+                of.write("#%s (SPK_SAMPLE_RATE == %d) && (SPK_PWM_BITS == %d) && (SPK_N_REPETITIONS == %d)\n"
+                         % ("if" if first else "elif", rate, bits, reps))
+                of.write("    // %.3f MHz VCO / %d / %d, PWM / %g: %+d ppm\n"
+                         % (vco / 1000, pd1, pd2, div / 16, round(ppm)))
+                of.write("    #define SYS_CLK_FREQ_KHZ        %d\n" % sys_khz)
+                of.write("    #define SYS_PLL_VCO_KHZ         %d\n" % vco)
+                of.write("    #define SYS_PLL_POSTDIV1        %d\n" % pd1)
+                of.write("    #define SYS_PLL_POSTDIV2        %d\n" % pd2)
+                of.write("    #define SPK_PWM_CLKDIV_INT      %d\n" % (div >> PWM_DIV_FRAC_BITS))
+                of.write("    #define SPK_PWM_CLKDIV_FRAC     %d\n" % (div & ((1 << PWM_DIV_FRAC_BITS) - 1)))
+                of.write("    #define SPK_RATE_ERROR_PPM      %d\n" % round(ppm))
+                # Idle, normal and boost, in clocks_level_t order
+                levels = [idle, p, boost]
+                of.write("    // Levels: %s\n" % ", ".join(
+                    "%.3f MHz (%+d ppm)" % (l[0] / 1000, round(l[5])) for l in levels))
+                of.write("    #define SYS_CLK_LEVEL_KHZ       { %s }\n"
+                         % ", ".join("%d" % l[0] for l in levels))
+                of.write("    #define SYS_CLK_LEVEL_PLANS     { %s }\n"
+                         % ", ".join("{ %d, %d, %d, %d, %d }"
+                                     % (l[1], l[2], l[3], l[4] >> PWM_DIV_FRAC_BITS,
+                                        l[4] & ((1 << PWM_DIV_FRAC_BITS) - 1))
+                                     for l in levels))
+                first = False
+    of.write("#else\n")
+    of.write("    #error \"No clock plan for this sample rate, SPK_PWM_BITS and SPK_N_REPETITIONS, see util/clockplan.py\"\n")
+    of.write("#endif\n\n\n")
+    of.write("#endif /* CLOCK_PLAN_H */\n")
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+
+"""
+Event-to-sound latency statistics from a firmware trace dump
+
+Usage: trace_latency.py [trace.txt]
+
+Notes:
+    - Build the firmware with TRACE_ENABLE (config.h, or -DTRACE_ENABLE=ON
+      for the host build) and capture the UART output, or the stdout of
+      momentum_sim. Lines other than `T,<t_us>,<event>,<arg>` are ignored, so
+      the raw capture can be given as is; reads stdin without a file.
+
+    - Each clash and swing is followed from the IMU interrupt through the main
+      loop poll and the mixer to the audio block that first plays it:
+            int->poll   IMU_INT to MAIN_CLASH / MAIN_SWING
+            poll->play  to SPK_PLAY, the voice handed to the mixer
+            play->audio to SPK_AUDIBLE, its first samples on the speaker
+            total       IMU_INT to SPK_AUDIBLE
+      and the count of LED frames held up by the previous one (late),
+      replaced before being sent (dropped) or dimmed to the current budget.
+      The time to send a frame is given too with TRACE_LED_FRAMES
+      (-DTRACE_LED_FRAMES=ON), which records every frame at the cost of
+      filling the trace buffer within seconds.
+"""
+
+import argparse
+import sys
+
+
+parser = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("trace", nargs="?", help="Trace dump, stdin if not given")
+args = parser.parse_args()
+
+# Mixer voices, see speaker.h
+SPK_VOICE_SWING = 2
+SPK_VOICE_CLASH = 3
+
+
+# Timestamps come from a free-running 32-bit microsecond counter
+def elapsed(t0, t1):
+    return (t1 - t0) % (1 << 32)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    idx = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[idx]
+
+
+def read_events(f):
+    events = []
+    lost = 0
+    for line in f:
+        fields = line.strip().split(",")
+        if len(fields) < 3 or fields[0] != "T":
+            continue
+        if fields[1] == "lost":
+            lost += int(fields[2])
+            continue
+        events.append((int(fields[1]), fields[2], int(fields[3])))
+    return events, lost
+
+
+# Follow each motion from its interrupt to the sound. Returns a list of
+# (int->poll, poll->play, play->audio) per motion kind.
+def motion_chains(events):
+    chains = {"clash": [], "swing": []}
+    last_int = None
+    pending = {}            # kind -> [t_int, t_poll, t_play]
+
+    for t, name, arg in events:
+        if name == "IMU_INT":
+            last_int = t
+        elif name in ("IMU_CLASH", "IMU_SWING"):
+            kind = name[4:].lower()
+            pending[kind] = [last_int, None, None]
+        elif name in ("MAIN_CLASH", "MAIN_SWING"):
+            kind = name[5:].lower()
+            if kind in pending and pending[kind][0] is not None:
+                pending[kind][1] = t
+        elif name == "SPK_PLAY":
+            kind = {SPK_VOICE_CLASH: "clash", SPK_VOICE_SWING: "swing"}.get(arg)
+            if kind in pending and pending[kind][1] is not None:
+                pending[kind][2] = t
+        elif name == "SPK_AUDIBLE":
+            for kind, voice in (("clash", SPK_VOICE_CLASH), ("swing", SPK_VOICE_SWING)):
+                p = pending.get(kind)
+                if (arg & (1 << voice)) and p and p[2] is not None:
+                    chains[kind].append((elapsed(p[0], p[1]),
+                                         elapsed(p[1], p[2]),
+                                         elapsed(p[2], t)))
+                    del pending[kind]
+    return chains
+
+
+def led_updates(events):
+    durations = []
+    start = None
+    late = dropped = dimmed = 0
+    for t, name, arg in events:
+        if name == "LED_SHOW":
+            start = t
+        elif name == "LED_DONE" and start is not None:
+            durations.append(elapsed(start, t))
+            start = None
+        elif name == "LED_LATE":
+            late += 1
+        elif name == "LED_DROP":
+            dropped += 1
+        elif name == "LED_LIMIT":
+            dimmed += 1
+    return durations, late, dropped, dimmed
+
+
+def print_stats(label, values):
+    if not values:
+        print("  %-12s       -" % label)
+        return
+    print("  %-12s %7d us p50 %7d us p99 %7d us max" %
+          (label, percentile(values, 50), percentile(values, 99), max(values)))
+
+
+f = open(args.trace) if args.trace else sys.stdin
+events, lost = read_events(f)
+if lost:
+    print("Warning: " + str(lost) + " events were lost to a full trace buffer")
+
+for kind, chain in motion_chains(events).items():
+    print(kind + " (" + str(len(chain)) + ")")
+    print_stats("int->poll", [c[0] for c in chain])
+    print_stats("poll->play", [c[1] for c in chain])
+    print_stats("play->audio", [c[2] for c in chain])
+    print_stats("total", [sum(c) for c in chain])
+
+durations, late, dropped, dimmed = led_updates(events)
+print("LED strip update (" + str(len(durations)) + ")")
+print_stats("show", durations)
+print("  " + str(late) + " late, " + str(dropped) + " dropped, " +
+      str(dimmed) + " dimmed")
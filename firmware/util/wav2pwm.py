@@ -3,7 +3,8 @@
 """
 Converts a directory of .wav files to a C header file of uint8_t PWM audio data
 
-Usage: wav2pwm.py <output_filename.h>
+Usage: wav2pwm.py [--adpcm | --pcm16] [--rate HZ] <output_filename.h>
+       wav2pwm.py --font [--adpcm | --pcm16] [--rate HZ] <output_filename.uf2> [font_dir ...]
 
 Notes:
     - The following files are expected to be present in the same directory
@@ -23,28 +24,183 @@ Notes:
             - A TUNE_POWERON_DATA, TUNE_POWEROFF_DATA, ... array of uint8_t
             - Swing sounds are accessible as TUNES_SWING_DATA[0], 
               TUNES_SWING_DATA[1], ..., and similarly with clash sounds
+            - A TUNE_POWERON_ENV, ... envelope track next to each sound, and
+              TUNES_SWING_ENVS / TUNES_CLASH_ENVS, see below
+
+    - With --adpcm, the arrays hold 4-bit IMA-ADPCM blocks (see adpcm.h in the
+      firmware) instead of 8-bit PCM, halving their size. The _LEN constants
+      are still in samples, and TUNES_FORMAT is defined as SOUND_FMT_ADPCM.
+
+    - With --pcm16, the arrays hold signed 16-bit little endian PCM instead,
+      twice the size of 8-bit PCM, for a speaker PWM of more than 8 bits
+      (SPK_PWM_BITS in the firmware). TUNES_FORMAT is SOUND_FMT_PCM16.
+
+    - The sounds are resampled to --rate, 44100 Hz by default, which must be
+      the SPK_SAMPLE_RATE of the firmware (TUNE_22KHZ, TUNE_8KHZ in
+      config.h). A font records its rate and is only loaded at that one.
+
+    - With --font, the sounds are packed into a binary sound font image (see
+      font.h in the firmware) and written as a .uf2 targeting the font
+      partition, which can be flashed without rebuilding the firmware.
+      Several directories of WAV files can be given, one per font, to pack
+      them all into the partition behind a font table; the saber can then
+      switch between them at runtime. Each font is named after its directory.
+
+    - Every sound comes with an envelope track: one byte per 2^ENV_SHIFT
+      samples (TUNES_ENV_SHIFT, or env_shift in the font header), the RMS of
+      those samples at the 16-bit scale the mixer plays them, >> 7. The LEDs
+      can follow the sound from it at the cost of a lookup. Fonts with tracks
+      are version 2 images.
 """
 
 import soundfile as sf
 import samplerate
 import argparse 
 import os
+import struct
 
 parser = argparse.ArgumentParser(description=__doc__)
-parser.add_argument("output", help="Output .h file")
-
-outfile = parser.parse_args().output
+parser.add_argument("output", help="Output .h file, or .uf2 file with --font")
+encoding = parser.add_mutually_exclusive_group()
+encoding.add_argument("--adpcm", action="store_true",
+                      help="Store 4-bit IMA-ADPCM instead of 8-bit PCM")
+encoding.add_argument("--pcm16", action="store_true",
+                      help="Store 16-bit PCM instead of 8-bit PCM")
+parser.add_argument("--font", action="store_true",
+                    help="Write a binary sound font image as a .uf2 instead of a C header")
+parser.add_argument("fonts", nargs="*", default=["."],
+                    help="With --font, directories of WAV files, one per font")
+parser.add_argument("--offset", type=lambda x: int(x, 0), default=0x100000,
+                    help="Flash offset of the font partition (FONT_FLASH_OFFSET)")
+parser.add_argument("--size", type=lambda x: int(x, 0), default=0x100000,
+                    help="Size of the font partition (FONT_FLASH_SIZE)")
+parser.add_argument("--rate", type=int, default=44100,
+                    help="Sample rate to resample to, in Hz (SPK_SAMPLE_RATE)")
+parser.add_argument("--env-shift", type=int, default=6,
+                    help="Envelope track step, log2 of samples (6 is 1.45 ms at 44.1 kHz)")
+
+args = parser.parse_args()
+outfile = args.output
 
 
 converter = 'sinc_best'  # or 'sinc_fastest', ...
-desired_sample_rate = 44100.0
+desired_sample_rate = float(args.rate)
+
+
+
+# IMA-ADPCM block layout, must match adpcm.h
+ADPCM_BLOCK_BYTES = 256
+ADPCM_HEADER_BYTES = 4
+ADPCM_BLOCK_SAMPLES = 2 * (ADPCM_BLOCK_BYTES - ADPCM_HEADER_BYTES)
+
+ADPCM_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+    19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+    130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+    5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+]
+
+ADPCM_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8,
+                     -1, -1, -1, -1, 2, 4, 6, 8]
+
+
+# Encodes one sample against the decoder state, returning the 4-bit code and
+# the new state exactly as the firmware decoder will reconstruct it
+def adpcm_encode_sample(sample, predictor, index):
+    step = ADPCM_STEP_TABLE[index]
+    diff = sample - predictor
+    code = 0
+    if diff < 0:
+        code = 8
+        diff = -diff
+    if diff >= step:
+        code |= 4
+        diff -= step
+    if diff >= step >> 1:
+        code |= 2
+        diff -= step >> 1
+    if diff >= step >> 2:
+        code |= 1
+
+    # Decode to track the decoder exactly
+    delta = step >> 3
+    if code & 4: delta += step
+    if code & 2: delta += step >> 1
+    if code & 1: delta += step >> 2
+    predictor = predictor - delta if code & 8 else predictor + delta
+    predictor = max(-32768, min(32767, predictor))
+    index = max(0, min(88, index + ADPCM_INDEX_TABLE[code]))
+    return code, predictor, index
+
+
+# Encodes signed 16-bit samples into self-contained ADPCM blocks
+def adpcm_encode(samples):
+    out = []
+    predictor = 0
+    index = 0
+    for start in range(0, len(samples), ADPCM_BLOCK_SAMPLES):
+        block = samples[start:start + ADPCM_BLOCK_SAMPLES]
+        block += [block[-1]] * (ADPCM_BLOCK_SAMPLES - len(block))
+
+        # Header holds the state before the first sample
+        p = predictor & 0xffff
+        out += [p & 0xff, p >> 8, index, 0]
+
+        codes = []
+        for v in block:
+            code, predictor, index = adpcm_encode_sample(v, predictor, index)
+            codes.append(code)
+        for i in range(0, len(codes), 2):
+            out.append(codes[i] | (codes[i + 1] << 4))
+    return out
+
+
+# Envelope track levels, must match SOUND_ENV_LEVEL_SHIFT in mixer.h
+ENV_LEVEL_SHIFT = 7
+
+
+# Computes the envelope track of signed 16-bit samples: the RMS of every
+# 2^shift samples, as a byte
+def envelope_track(samples, shift):
+    step = 1 << shift
+    track = []
+    for start in range(0, len(samples), step):
+        chunk = samples[start:start + step]
+        rms = (sum(v * v for v in chunk) / len(chunk)) ** 0.5
+        track.append(min(255, int(rms) >> ENV_LEVEL_SHIFT))
+    return track
+
+
+# Writes a C array of byte values
+def write_array(name, values, of):
+    of.write("const uint8_t __in_flash() " + name + "[] = {\r\n    ")
 
+    maxitemsperline = 16
+    itemsonline = maxitemsperline
+    count = 0
+    for v in values:
+        of.write(str(v))
+        itemsonline-=1
+        if (count == len(values) - 1):
+            of.write("\r\n")
+        elif (itemsonline>0):
+            of.write(',')
+        else:
+            itemsonline = maxitemsperline
+            of.write(',\r\n    ')
+        count += 1
 
+    of.write('};\r\n\n')
 
-# Converts one audio file and returns its length
-def audio_convert(name_base, wf, of):
-    # Print some helpful identifying information in the header file
-    of.write("// "+wf+"\n")
+
+# Loads and converts one audio file. Returns its length in samples, its data
+# as a list of byte values and its envelope track.
+def audio_load(wf):
     data_in, datasamplerate = sf.read(wf)
 
     # If data is stereo, take only the first channel
@@ -56,126 +212,243 @@ def audio_convert(name_base, wf, of):
     minValue = min(data_out)
     vrange = (maxValue - minValue) 
 
-    of.write("#define TUNE_" + name_base + "_LEN "+str(len(data_out))+" \r\n\r\n")
-    of.write("const uint8_t __in_flash() TUNE_" + name_base + "_DATA[] = {\r\n    ")
-
-    maxitemsperline = 16
-    itemsonline = maxitemsperline
-    firstvalue = 0
-    lastvalue = 0
-    count = 0
-    for v in data_out:
-        # scale v to between 0 and 1
-        isin = (v-minValue)/vrange   
-        v =  int((isin * 255))
-        vstr = str(v)
-        if (firstvalue==0):
-            firstvalue= v
-        lastvalue = v
-        of.write(vstr)
-        itemsonline-=1
-        if (count == len(data_out) - 1):
-            of.write("\r\n")
-        elif (itemsonline>0):
-            of.write(',')
+    if args.adpcm or args.pcm16:
+        # scale v to signed 16-bit full scale
+        vmid = (maxValue + minValue) / 2
+        samples = [int((v - vmid) / vrange * 2 * 32767) for v in data_out]
+        if args.adpcm:
+            values = adpcm_encode(samples)
         else:
-            itemsonline = maxitemsperline
-            of.write(',\r\n    ')
-        count += 1
-            
+            values = list(b"".join(struct.pack("<h", v) for v in samples))
+    else:
+        # scale v to between 0 and 1
+        values = [int(((v - minValue) / vrange) * 255) for v in data_out]
+        # as the mixer plays them
+        samples = [(v - 128) << 8 for v in values]
+
     # keep track of first and last values to avoid
     # blip when the loop restarts.. make the end value
     # the average of the first and last. 
     #end_value = int( (firstvalue + lastvalue) / 2)
     #of.write(str(end_value)+'    \r\n};')
-    
-    of.write('};\r\n\n')
-    
-    return len(data_out)
-
 
+    return len(data_out), values, envelope_track(samples, args.env_shift)
 
-with open(outfile, 'w') as of:
-    of.write("/**\n")
-    of.write(" * @file    "+outfile+"\n")
-    of.write(" * @brief   <DESCRIPTION>\n")
-    of.write(" */\n\n\n")
-    of.write("#include <pico/platform.h>\n\n\n");
-
-    # Get all files in the current directory
-    files = os.listdir(os.getcwd())
 
+# Finds the sound files in a directory. Returns lists of (name, file) for the
+# poweron, poweroff and hum sounds, the swing sounds and the clash sounds.
+def find_sounds(directory):
     # Get all .wav files only
-    wav_files = [f for f in files if f.endswith(".wav")]
-
-    total_size = 0;
-    
-    # First, process the power on sound
-    for wf in wav_files:
-        if wf.startswith("poweron"):
-            total_size += audio_convert("POWERON", wf, of)
-            break
-
-    # Next, process the power off sound
-    for wf in wav_files:
-        if wf.startswith("poweroff"):
-            total_size += audio_convert("POWEROFF", wf, of)
-            break
-    
-    # Next, process the hum sound
-    for wf in wav_files:
-        if wf.startswith("hum"):
-            total_size += audio_convert("HUM", wf, of)
-            break
-
-    # Next, process any swing sounds
-    swing_file_count = 0
-    for wf in wav_files:
-        if wf.startswith("swing"):
-            total_size += audio_convert("SWING" + str(swing_file_count), wf, of)
-            swing_file_count += 1
-
-    # Finally, process any clash sounds
-    clash_file_count = 0
-    for wf in wav_files:
-        if wf.startswith("clash"):
-            total_size += audio_convert("CLASH" + str(clash_file_count), wf, of)
-            clash_file_count += 1
-
-    # For convenience, defines for the number of swing and clash sounds
-    of.write("#define TUNES_SWING_COUNT "+str(swing_file_count)+"\r\n")
-    of.write("#define TUNES_CLASH_COUNT "+str(clash_file_count)+"\r\n\r\n")
-    
-    # Make C arrays to be able to access swing and clash sounds more easily
-    of.write("const uint8_t *TUNES_SWING_DATA[] = {\r\n")
-    for i in range(swing_file_count):
-        of.write("    TUNE_SWING"+str(i)+"_DATA")
-        if i < swing_file_count-1: of.write(",")
-        of.write("\r\n")
-    of.write("};\r\n\r\n")
-    of.write("uint32_t TUNES_SWING_LENS[] = {\r\n")
-    for i in range(swing_file_count):
-        of.write("    TUNE_SWING"+str(i)+"_LEN")
-        if i < swing_file_count-1: of.write(",")
-        of.write("\r\n")
-    of.write("};\r\n\r\n")
-
-    of.write("const uint8_t *TUNES_CLASH_DATA[] = {\r\n")
-    for i in range(clash_file_count):
-        of.write("    TUNE_CLASH"+str(i)+"_DATA")
-        if i < clash_file_count-1: of.write(",")
-        of.write("\r\n")
-    of.write("};\r\n\r\n")
-    of.write("uint32_t TUNES_CLASH_LENS[] = {\r\n")
-    for i in range(clash_file_count):
-        of.write("    TUNE_CLASH"+str(i)+"_LEN")
-        if i < clash_file_count-1: of.write(",")
-        of.write("\r\n")
-    of.write("};\r\n\r\n")
-    
-    of.write("// Total size: " + str(total_size) + "\r\n\r\n");
-
-    of.close()
+    wav_files = sorted(f for f in os.listdir(directory) if f.endswith(".wav"))
+    wav_files = [os.path.join(directory, f) for f in wav_files]
+
+    fixed = []
+    for base in ["poweron", "poweroff", "hum"]:
+        for wf in wav_files:
+            if os.path.basename(wf).startswith(base):
+                fixed.append((base.upper(), wf))
+                break
+        else:
+            raise SystemExit("Missing " + base + ".wav")
+
+    swings = [wf for wf in wav_files if os.path.basename(wf).startswith("swing")]
+    clashes = [wf for wf in wav_files if os.path.basename(wf).startswith("clash")]
+    swings = [("SWING" + str(i), wf) for i, wf in enumerate(swings)]
+    clashes = [("CLASH" + str(i), wf) for i, wf in enumerate(clashes)]
+    return fixed, swings, clashes
+
+
+# Writes all sounds into a C header file
+def write_header(outfile, fixed, swings, clashes):
+    with open(outfile, 'w') as of:
+        of.write("/**\n")
+        of.write(" * @file    "+outfile+"\n")
+        of.write(" * @brief   <DESCRIPTION>\n")
+        of.write(" */\n\n\n")
+        of.write("#include <pico/platform.h>\n\n\n");
+
+        if args.adpcm:
+            of.write("#define TUNES_FORMAT SOUND_FMT_ADPCM\r\n\r\n")
+        elif args.pcm16:
+            of.write("#define TUNES_FORMAT SOUND_FMT_PCM16\r\n\r\n")
+        of.write("#define TUNES_ENV_SHIFT " + str(args.env_shift) + "\r\n\r\n")
+
+        total_size = 0;
+
+        for name_base, wf in fixed + swings + clashes:
+            # Print some helpful identifying information in the header file
+            of.write("// "+wf+"\n")
+            n_samples, values, env = audio_load(wf)
+            of.write("#define TUNE_" + name_base + "_LEN "+str(n_samples)+" \r\n\r\n")
+            write_array("TUNE_" + name_base + "_DATA", values, of)
+            write_array("TUNE_" + name_base + "_ENV", env, of)
+            total_size += len(values) + len(env)
+
+        swing_file_count = len(swings)
+        clash_file_count = len(clashes)
+
+        # For convenience, defines for the number of swing and clash sounds
+        of.write("#define TUNES_SWING_COUNT "+str(swing_file_count)+"\r\n")
+        of.write("#define TUNES_CLASH_COUNT "+str(clash_file_count)+"\r\n\r\n")
+        
+        # Make C arrays to be able to access swing and clash sounds more easily
+        of.write("const uint8_t *TUNES_SWING_DATA[] = {\r\n")
+        for i in range(swing_file_count):
+            of.write("    TUNE_SWING"+str(i)+"_DATA")
+            if i < swing_file_count-1: of.write(",")
+            of.write("\r\n")
+        of.write("};\r\n\r\n")
+        of.write("uint32_t TUNES_SWING_LENS[] = {\r\n")
+        for i in range(swing_file_count):
+            of.write("    TUNE_SWING"+str(i)+"_LEN")
+            if i < swing_file_count-1: of.write(",")
+            of.write("\r\n")
+        of.write("};\r\n\r\n")
+        of.write("const uint8_t *TUNES_SWING_ENVS[] = {\r\n")
+        for i in range(swing_file_count):
+            of.write("    TUNE_SWING"+str(i)+"_ENV")
+            if i < swing_file_count-1: of.write(",")
+            of.write("\r\n")
+        of.write("};\r\n\r\n")
+
+        of.write("const uint8_t *TUNES_CLASH_DATA[] = {\r\n")
+        for i in range(clash_file_count):
+            of.write("    TUNE_CLASH"+str(i)+"_DATA")
+            if i < clash_file_count-1: of.write(",")
+            of.write("\r\n")
+        of.write("};\r\n\r\n")
+        of.write("uint32_t TUNES_CLASH_LENS[] = {\r\n")
+        for i in range(clash_file_count):
+            of.write("    TUNE_CLASH"+str(i)+"_LEN")
+            if i < clash_file_count-1: of.write(",")
+            of.write("\r\n")
+        of.write("};\r\n\r\n")
+        of.write("const uint8_t *TUNES_CLASH_ENVS[] = {\r\n")
+        for i in range(clash_file_count):
+            of.write("    TUNE_CLASH"+str(i)+"_ENV")
+            if i < clash_file_count-1: of.write(",")
+            of.write("\r\n")
+        of.write("};\r\n\r\n")
+        
+        of.write("// Total size: " + str(total_size) + "\r\n\r\n");
+
+
+# Font image layout, must match font.h
+FONT_MAGIC = 0x544e464d
+FONT_VERSION = 2
+FONT_TABLE_MAGIC = 0x4254464d
+FONT_TABLE_VERSION = 1
+FONT_TABLE_FORMAT = "<IHBx8I"
+FONT_MAX_FONTS = 8
+FONT_HEADER_FORMAT = "<IHBBBB2xII16s"
+FONT_ENTRY_FORMAT = "<III"
+FONT_NAME_LEN = 16
+
+SOUND_FMT_PCM8 = 0
+SOUND_FMT_ADPCM = 1
+SOUND_FMT_PCM16 = 2
+
+
+# The SOUND_FMT_* the sounds are stored as
+def sound_format():
+    if args.adpcm:
+        return SOUND_FMT_ADPCM
+    if args.pcm16:
+        return SOUND_FMT_PCM16
+    return SOUND_FMT_PCM8
+
+
+# Packs all sounds into a binary font image
+def build_font(name, fixed, swings, clashes):
+    sounds = [audio_load(wf) for name_base, wf in fixed + swings + clashes]
+
+    header_size = struct.calcsize(FONT_HEADER_FORMAT)
+    offset = header_size + len(sounds) * struct.calcsize(FONT_ENTRY_FORMAT)
+
+    entries = b""
+    data = b""
+    for n_samples, values, env in sounds:
+        # Keep every sound word aligned, with its envelope track behind it
+        pad = (-(offset + len(data))) % 4
+        data += bytes(pad)
+        data_offset = offset + len(data)
+        data += bytes(values)
+        entries += struct.pack(FONT_ENTRY_FORMAT, data_offset, n_samples,
+                               offset + len(data))
+        data += bytes(env)
+
+    size = offset + len(data)
+    header = struct.pack(FONT_HEADER_FORMAT,
+                         FONT_MAGIC, FONT_VERSION,
+                         sound_format(),
+                         len(swings), len(clashes), args.env_shift,
+                         int(desired_sample_rate), size,
+                         name.encode()[:FONT_NAME_LEN])
+    return header + entries + data
+
+
+# Packs several font images behind a font table
+def build_font_table(images):
+    if len(images) > FONT_MAX_FONTS:
+        raise SystemExit("At most " + str(FONT_MAX_FONTS) + " fonts")
+
+    offset = struct.calcsize(FONT_TABLE_FORMAT)
+    offsets = []
+    data = b""
+    for image in images:
+        data += bytes((-(offset + len(data))) % 4)
+        offsets.append(offset + len(data))
+        data += image
+    offsets += [0] * (FONT_MAX_FONTS - len(offsets))
+
+    table = struct.pack(FONT_TABLE_FORMAT, FONT_TABLE_MAGIC, FONT_TABLE_VERSION,
+                        len(images), *offsets)
+    return table + data
+
+
+# UF2 container, see https://github.com/microsoft/uf2
+UF2_MAGIC_START0 = 0x0a324655
+UF2_MAGIC_START1 = 0x9e5d5157
+UF2_MAGIC_END = 0x0ab16f30
+UF2_FLAG_FAMILY_ID = 0x00002000
+UF2_FAMILY_RP2040 = 0xe48bff56
+UF2_PAYLOAD_SIZE = 256
+RP2040_XIP_BASE = 0x10000000
+
+
+# Wraps a binary image in a UF2 to be flashed at the given flash offset
+def write_uf2(outfile, image, flash_offset):
+    n_blocks = (len(image) + UF2_PAYLOAD_SIZE - 1) // UF2_PAYLOAD_SIZE
+    with open(outfile, 'wb') as of:
+        for i in range(n_blocks):
+            payload = image[i * UF2_PAYLOAD_SIZE:(i + 1) * UF2_PAYLOAD_SIZE]
+            payload += bytes(UF2_PAYLOAD_SIZE - len(payload))
+            block = struct.pack("<IIIIIIII",
+                                UF2_MAGIC_START0, UF2_MAGIC_START1,
+                                UF2_FLAG_FAMILY_ID,
+                                RP2040_XIP_BASE + flash_offset + i * UF2_PAYLOAD_SIZE,
+                                UF2_PAYLOAD_SIZE, i, n_blocks,
+                                UF2_FAMILY_RP2040)
+            block += payload + bytes(476 - UF2_PAYLOAD_SIZE)
+            block += struct.pack("<I", UF2_MAGIC_END)
+            of.write(block)
+
+
+if args.font:
+    images = []
+    for directory in args.fonts:
+        name = os.path.basename(os.path.abspath(directory))
+        images.append(build_font(name, *find_sounds(directory)))
+        print("Font '" + name + "': " + str(len(images[-1])) + " bytes")
+
+    # A single font is flashed bare, several behind a font table
+    image = images[0] if len(images) == 1 else build_font_table(images)
+    if len(image) > args.size:
+        raise SystemExit("Fonts are " + str(len(image)) + " bytes, partition is only "
+                         + str(args.size))
+    write_uf2(outfile, image, args.offset)
+else:
+    write_header(outfile, *find_sounds("."))
 
 '''
 soundfile = parser.parse_args().input